@@ -8,10 +8,10 @@ MANPREFIX = $(PREFIX)/share/man
 
 PKG_CONFIG = pkg-config
 
-DEPENDENCIES = xcb xcb-shm xcb-image xcb-keysyms xcb-cursor libpng
+DEPENDENCIES = xcb xcb-shm xcb-present xcb-xfixes xcb-image xcb-keysyms xcb-cursor libpng
 
 INCS = $(shell $(PKG_CONFIG) --cflags $(DEPENDENCIES)) -Iinclude
-LIBS = $(shell $(PKG_CONFIG) --libs $(DEPENDENCIES)) -lm
+LIBS = $(shell $(PKG_CONFIG) --libs $(DEPENDENCIES)) -lm -lpthread
 
 CFLAGS = -std=c11 -pedantic -Wall -Wextra -Os $(INCS) -DVERSION=\"$(VERSION)\"
 LDFLAGS = -s $(LIBS)
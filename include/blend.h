@@ -0,0 +1,76 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Span kernels. Every kernel has a scalar version built on top of the
+ * functions of color.h, which is the reference the vectorized versions
+ * must match bit by bit. blend_init picks the best version supported by
+ * the cpu and must be called before any other function of this file.
+ *
+ * Pixels are premultiplied by their alpha, so mixing two of them is a
+ * plain interpolation of the four channels and mixing towards the
+ * transparent color just scales the pixel down.
+ *
+ * In BLEND_LINEAR the color channels are interpolated in linear light
+ * (see color_mix_linear), which keeps soft edges from getting darker.
+ * The pixels are still stored gamma encoded, so it is exact for opaque
+ * pixels and a close approximation for the rest.
+ */
+
+typedef enum {
+	BLEND_SRGB,
+	BLEND_LINEAR
+} BlendSpace;
+
+extern void
+blend_init(BlendSpace space);
+
+/* dst[i] = color_over(src[i], bg[i]) */
+extern void
+blend_over_bg(uint32_t *dst, const uint32_t *src, const uint32_t *bg, int n);
+
+extern void
+blend_over_bg_scalar(uint32_t *dst, const uint32_t *src, const uint32_t *bg, int n);
+
+/* dst[i] = color_mix(color, dst[i], alpha[i]) */
+extern void
+blend_mix_color(uint32_t *dst, uint32_t color, const uint8_t *alpha, int n);
+
+extern void
+blend_mix_color_scalar(uint32_t *dst, uint32_t color, const uint8_t *alpha, int n);
+
+/* dst[i] = color_mix(color, dst[i], alpha) */
+extern void
+blend_mix_color_const(uint32_t *dst, uint32_t color, uint8_t alpha, int n);
+
+extern void
+blend_mix_color_const_scalar(uint32_t *dst, uint32_t color, uint8_t alpha, int n);
+
+/* the BLEND_LINEAR versions of the kernels above */
+extern void
+blend_over_bg_linear_scalar(uint32_t *dst, const uint32_t *src, const uint32_t *bg, int n);
+
+extern void
+blend_mix_color_linear_scalar(uint32_t *dst, uint32_t color, const uint8_t *alpha, int n);
+
+extern void
+blend_mix_color_const_linear_scalar(uint32_t *dst, uint32_t color, uint8_t alpha, int n);
@@ -0,0 +1,40 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * The footprint of a round brush dab of a given radius, centered at (0, 0).
+ * Row `dy` (from -radius to radius - 1) covers the columns x0[dy + radius]
+ * to x1[dy + radius], both inclusive (empty if x0 > x1). `alpha` holds, for
+ * each pixel of the 2*radius x 2*radius box, how much of the existing color
+ * is kept when the brush color is mixed in (0 at the center).
+ */
+typedef struct {
+	int radius;
+	int *x0, *x1;
+	uint8_t *alpha;
+} BrushStamp;
+
+extern const BrushStamp *
+brush_stamp_get(int radius);
+
+extern void
+brush_stamp_cache_free(void);
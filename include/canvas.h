@@ -18,11 +18,24 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
 
 typedef struct Canvas Canvas;
+typedef struct CanvasCheckpoint CanvasCheckpoint;
+typedef struct CanvasDelta CanvasDelta;
+
+/* bytes the history takes, with its pixels raw and packed */
+typedef struct {
+	size_t raw;
+	size_t packed;
+} CanvasHistoryStats;
+
+extern void
+canvas_use_present(bool use);
 
 extern Canvas *
 canvas_new(xcb_connection_t *conn, xcb_window_t win, int w, int h, uint32_t bg);
@@ -36,15 +49,60 @@ canvas_save(const Canvas *c, const char *path);
 extern void
 canvas_move_relative(Canvas *c, int offx, int offy);
 
+extern void
+canvas_zoom(Canvas *c, int steps, int vx, int vy);
+
+extern float
+canvas_get_zoom(const Canvas *c);
+
+extern void
+canvas_get_size(const Canvas *c, int *width, int *height);
+
 extern void
 canvas_set_viewport(Canvas *c, int vw, int vh);
 
+extern void
+canvas_invalidate(Canvas *c);
+
+extern bool
+canvas_can_render(const Canvas *c);
+
+extern xcb_drawable_t
+canvas_begin_frame(Canvas *c);
+
+extern void
+canvas_end_frame(Canvas *c);
+
 extern void
 canvas_render(Canvas *c);
 
+extern bool
+canvas_try_process_event(Canvas *c, const xcb_generic_event_t *ev);
+
 extern void
 canvas_set_pixel(Canvas *c, int x, int y, uint32_t color);
 
+extern void
+canvas_fill_hspan(Canvas *c, int x0, int x1, int y, uint32_t color);
+
+extern void
+canvas_mix_hspan(Canvas *c, int x0, int x1, int y, uint32_t color,
+		const uint8_t *alpha);
+
+extern void
+canvas_mix_hspan_from(Canvas *c, int x0, int x1, int y, uint32_t color,
+		const uint8_t *alpha, const uint32_t *src);
+
+extern void
+canvas_blend_hspan(Canvas *c, int x0, int x1, int y, uint32_t color,
+		uint8_t alpha);
+
+extern void
+canvas_fill_rect(Canvas *c, int x, int y, int w, int h, uint32_t color);
+
+extern const uint32_t *
+canvas_get_row(const Canvas *c, int x, int y, int *x0, int *x1);
+
 extern int
 canvas_get_pixel(Canvas *c, int x, int y, uint32_t *color);
 
@@ -54,5 +112,38 @@ canvas_viewport_to_canvas_pos(Canvas *c, int x, int y, int *out_x, int *out_y);
 extern void
 canvas_clear(Canvas *c);
 
+extern CanvasCheckpoint *
+canvas_checkpoint_new(Canvas *c);
+
+extern void
+canvas_checkpoint_restore(Canvas *c, const CanvasCheckpoint *cp);
+
+extern void
+canvas_checkpoint_free(Canvas *c, CanvasCheckpoint *cp);
+
+extern void
+canvas_checkpoint_fold(Canvas *c, const CanvasCheckpoint *cp);
+
+extern void
+canvas_delta_reset(Canvas *c);
+
+extern CanvasDelta *
+canvas_delta_take(Canvas *c);
+
+extern void
+canvas_delta_undo(Canvas *c, const CanvasDelta *d);
+
+extern void
+canvas_delta_redo(Canvas *c, const CanvasDelta *d);
+
+extern void
+canvas_delta_free(Canvas *c, CanvasDelta *d);
+
+extern void
+canvas_history_sweep(Canvas *c);
+
+extern void
+canvas_get_history_stats(const Canvas *c, CanvasHistoryStats *stats);
+
 extern void
 canvas_free(Canvas *c);
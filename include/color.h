@@ -25,6 +25,16 @@
 #define BLUE(c) ((c>>0) & 0xff)
 #define ALPHA(c) ((c>>24) & 0xff)
 
+#define COLOR_LINEAR_BITS (16)
+#define COLOR_LINEAR_INV_BITS (12)
+#define COLOR_LINEAR_INV_SIZE (1 << COLOR_LINEAR_INV_BITS)
+
+/* 8 bit sRGB to 16 bit linear light and back, from its
+ * 12 most significant bits. Built by color_linear_init,
+ * both have some padding for 32 bit gathers */
+extern uint16_t color_to_linear[];
+extern uint8_t color_from_linear[];
+
 extern uint32_t
 color_pack_from_arr(uint8_t *p);
 
@@ -36,3 +46,24 @@ color_parse(const char *str, uint32_t *c);
 
 extern uint32_t
 color_mix(uint32_t c1, uint32_t c2, uint8_t alpha);
+
+extern uint32_t
+color_over(uint32_t src, uint32_t bg);
+
+extern void
+color_linear_init(void);
+
+extern uint32_t
+color_mix_linear(uint32_t c1, uint32_t c2, uint8_t alpha);
+
+extern uint32_t
+color_over_linear(uint32_t src, uint32_t bg);
+
+extern uint32_t
+color_premultiply(uint32_t c);
+
+extern uint32_t
+color_unpremultiply(uint32_t c);
+
+extern uint32_t
+color_average(uint32_t c1, uint32_t c2, uint32_t c3, uint32_t c4);
@@ -0,0 +1,52 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+
+#define DAMAGE_MAX_RECTS (16)
+
+typedef struct Damage Damage;
+
+/* half open: covers [x0, x1) x [y0, y1) */
+typedef struct {
+	int x0, y0;
+	int x1, y1;
+} DamageRect;
+
+/*
+ * A region made of a bounded list of disjoint rectangles. Rectangles that
+ * overlap, or that would waste little area if joined, are merged as they
+ * are added. When the list is full the two rectangles whose union wastes
+ * the least area are merged.
+ */
+struct Damage {
+	DamageRect rects[DAMAGE_MAX_RECTS + 1];
+	int nrects;
+	int last;
+};
+
+extern void
+damage_clear(Damage *d);
+
+extern bool
+damage_is_empty(const Damage *d);
+
+extern void
+damage_add(Damage *d, int x, int y, int w, int h);
@@ -0,0 +1,72 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "canvas.h"
+
+typedef struct Fill Fill;
+
+/*
+ * Paint with `color` the 4-connected region of pixels that share the color
+ * of (x, y). Only touches canvas pixels; it records nothing and does not
+ * render, so it serves both the initial fill and its replay from history.
+ * Once a fill grows large, the rest of the region is labelled by a pool of
+ * worker threads, which yields the same pixels.
+ */
+extern void
+fill_flood(Canvas *canvas, int x, int y, uint32_t color);
+
+/*
+ * The same fill, done a slice at a time: fill_new starts it (NULL if there
+ * is nothing to paint) and every fill_step paints about `max_pixels` more,
+ * returning true once the region is done. The end result is the one of
+ * fill_flood, and until fill_free the painted pixels can be put back as
+ * they were with fill_rollback. While the workers label a large region a
+ * step only waits a few milliseconds for them, unless it is asked for
+ * SIZE_MAX pixels, which finishes the fill.
+ */
+extern Fill *
+fill_new(Canvas *canvas, int x, int y, uint32_t color);
+
+extern bool
+fill_step(Fill *f, size_t max_pixels);
+
+/*
+ * Share of the region painted so far, 1 when done. Negative while its size
+ * is unknown, which is until the workers have labelled it.
+ */
+extern float
+fill_progress(const Fill *f);
+
+extern void
+fill_rollback(Fill *f);
+
+extern void
+fill_free(Fill *f);
+
+/*
+ * Number of threads large fills are labelled with, 0 (the default) for
+ * one per processor. With 1, fills stay sequential.
+ */
+extern void
+fill_set_threads(int nthreads);
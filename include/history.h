@@ -19,6 +19,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct HistoryUserAction HistoryUserAction;
@@ -42,6 +43,9 @@ typedef struct {
 	int x, y;
 } HistoryPoint;
 
+typedef void (*HistoryCheckpointFreeFunc)(void *checkpoint);
+typedef void (*HistoryDeltaFreeFunc)(void *delta);
+
 struct HistoryUserAction {
 	HistoryUserAction *prev;
 	HistoryUserAction *next;
@@ -69,11 +73,35 @@ struct HistoryUserAction {
 			int x, y;
 		} bucket;
 	};
+
+	/* what the canvas looked like right after this action, if kept */
+	void *checkpoint;
+
+	/* the pixels it changed, before and after, if kept */
+	void *delta;
 };
 
+/*
+ * Checkpoints spare undo/redo the replay of the whole history: the canvas
+ * is restored from the last one before the target and only the actions
+ * after it are replayed. The history only keeps them: it asks for one every
+ * `checkpoint_interval` actions, and drops the ones past an action that
+ * gets replaced along with the redo branch, or folded into the root.
+ */
 struct History {
 	HistoryUserAction *root;
 	HistoryUserAction *current;
+
+	HistoryCheckpointFreeFunc checkpoint_free;
+	int checkpoint_interval;
+
+	/* deltas let undo/redo swap the changed pixels instead of
+	 * replaying */
+	HistoryDeltaFreeFunc delta_free;
+
+	/* bytes taken by the actions, their checkpoints and deltas
+	 * aside, kept up to date as they are added and dropped */
+	size_t size;
 };
 
 extern History *
@@ -94,6 +122,34 @@ history_undo(History *hist);
 extern bool
 history_redo(History *hist);
 
+extern void
+history_set_checkpoints(History *hist, int interval,
+		HistoryCheckpointFreeFunc free_func);
+
+extern bool
+history_wants_checkpoint(const History *hist);
+
+extern void
+history_add_checkpoint(History *hist, HistoryUserAction *hua, void *checkpoint);
+
+extern HistoryUserAction *
+history_last_checkpoint(const History *hist, HistoryUserAction *hua);
+
+extern void
+history_set_deltas(History *hist, HistoryDeltaFreeFunc free_func);
+
+extern void
+history_add_delta(History *hist, HistoryUserAction *hua, void *delta);
+
+extern bool
+history_drop_oldest_delta(History *hist);
+
+extern void
+history_fold(History *hist, HistoryUserAction *hua);
+
+extern size_t
+history_action_size(const HistoryUserAction *hua);
+
 extern void
 history_user_action_destroy(HistoryUserAction *hua);
 
@@ -0,0 +1,78 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "canvas.h"
+#include "history.h"
+
+typedef struct Raster Raster;
+
+typedef void (*RasterReplayFunc)(const HistoryUserAction *a);
+
+/*
+ * The pixels of the canvas get painted on a thread of their own. The thread
+ * that handles the input pushes commands into a single producer, single
+ * consumer queue and never waits for them to be painted, the raster thread
+ * runs them in order and tells it through raster_get_fd when the canvas has
+ * new damage to present.
+ *
+ * Both threads must hold the lock while touching the pixels or the damage
+ * of the canvas (e.g. to render a frame). After raster_sync returns, every
+ * command pushed so far has been painted and the raster thread keeps off
+ * the canvas until the next one is pushed.
+ */
+extern Raster *
+raster_new(Canvas *canvas, RasterReplayFunc replay);
+
+extern void
+raster_stroke_begin(Raster *r, uint32_t color, int size, int x, int y);
+
+extern void
+raster_stroke_point(Raster *r, int x, int y);
+
+extern void
+raster_stroke_end(Raster *r);
+
+/* replays a copy of the action, it can't be a stroke */
+extern void
+raster_replay(Raster *r, const HistoryUserAction *a);
+
+extern void
+raster_sync(Raster *r);
+
+extern void
+raster_lock(Raster *r);
+
+extern bool
+raster_trylock(Raster *r);
+
+extern void
+raster_unlock(Raster *r);
+
+extern int
+raster_get_fd(const Raster *r);
+
+extern bool
+raster_take_damage(Raster *r);
+
+extern void
+raster_free(Raster *r);
@@ -0,0 +1,46 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "canvas.h"
+
+typedef struct Stroke Stroke;
+
+/*
+ * A stroke paints the capsules (segments with round caps) between its
+ * consecutive points. Every pixel covered by the stroke is mixed with the
+ * brush color once, with the highest coverage any of its segments gives
+ * it, so overlapping segments and joins never darken the stroke.
+ *
+ * Points only update the coverage of the stroke, it reaches the canvas
+ * on stroke_flush (and stroke_free), only where it changed since then.
+ */
+extern Stroke *
+stroke_new(Canvas *canvas, uint32_t color, int size);
+
+extern void
+stroke_add_point(Stroke *s, int x, int y);
+
+extern void
+stroke_flush(Stroke *s);
+
+extern void
+stroke_free(Stroke *s);
@@ -67,5 +67,11 @@ toolbar_set_tool(Toolbar *tb, Tool tool);
 extern void
 toolbar_set_fill_mode(Toolbar *tb, bool fill);
 
+extern void
+toolbar_set_progress(Toolbar *tb, float progress);
+
+extern void
+toolbar_pulse_progress(Toolbar *tb);
+
 extern void
 toolbar_free(Toolbar *tb);
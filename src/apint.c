@@ -30,6 +30,8 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <math.h>
+#include <poll.h>
+#include <time.h>
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
 #include <xcb/xcb_keysyms.h>
@@ -39,12 +41,17 @@
 #include <stdbool.h>
 #include <xkbcommon/xkbcommon-keysyms.h>
 
+#include "blend.h"
+#include "brush.h"
 #include "color.h"
 #include "log.h"
 #include "utils.h"
 #include "canvas.h"
+#include "fill.h"
 #include "picker.h"
 #include "history.h"
+#include "raster.h"
+#include "stroke.h"
 #include "toolbar.h"
 
 typedef struct {
@@ -58,9 +65,6 @@ typedef struct {
 	uint32_t color;
 	int brush_size;
 	xcb_point_t mouse_pos;
-	int last_x;
-	int last_y;
-	bool has_prev;
 	Tool tool;
 	bool fill_mode;
 } DrawInfo;
@@ -71,10 +75,41 @@ typedef struct {
 	int cur_vx, cur_vy;
 } ShapeInfo;
 
+typedef struct {
+	HistoryPoint *points;
+	int npoints;
+	int cap;
+} MotionBatch;
+
+typedef enum {
+	REDRAW_CANVAS        = 1 << 0,
+	REDRAW_BRUSH_PREVIEW = 1 << 1,
+	REDRAW_SHAPE_PREVIEW = 1 << 2
+} Redraw;
+
+typedef struct {
+	Fill *fill;
+	int x, y;
+	uint32_t color;
+} FillJob;
+
+typedef struct {
+	unsigned redraw;
+	int max_fps;
+	struct timespec last;
+	unsigned long presented;
+	unsigned long skipped;
+} FrameInfo;
+
 #define APINT_WM_NAME "apint"
 #define APINT_WM_CLASS "apint\0apint\0"
-#define APINT_STROKE_SPACING_FACTOR 0.55f
 #define APINT_MAX_BRUSH_SIZE (100)
+#define APINT_MAX_CANVAS_SIZE (32768)
+#define APINT_DEFAULT_MAX_FPS (60)
+#define APINT_FILL_STEP_PIXELS (1 << 18)
+#define APINT_DEFAULT_CHECKPOINT_INTERVAL (32)
+#define APINT_DEFAULT_HISTORY_BUDGET_MB (256)
+#define APINT_CHECKPOINT_COST_NS (100000000L)
 
 #ifndef APINT_NO_HISTORY
 #define APINT_HISTORY 1
@@ -83,9 +118,15 @@ typedef struct {
 #ifdef APINT_HISTORY
 static History *hist;
 static HistoryUserAction *hist_stroke;
+static CanvasHistoryStats hist_stats;
 #endif
 
+static int checkpoint_interval;
+static int history_budget_mb;
+static bool use_deltas;
+
 static Canvas *canvas;
+static Raster *raster;
 static Picker *picker;
 static Toolbar *toolbar;
 static xcb_connection_t *conn;
@@ -100,7 +141,13 @@ static xcb_cursor_t cursor_crosshair;
 static DrawInfo drawinfo;
 static DragInfo draginfo;
 static ShapeInfo shapeinfo;
+static FrameInfo frameinfo;
+static MotionBatch motion;
+static FillJob filljob;
+static xcb_generic_event_t *queued_event;
 static bool start_in_fullscreen;
+static bool print_frame_stats;
+static bool linear_blending;
 static bool should_close;
 
 static xcb_atom_t
@@ -226,107 +273,128 @@ xwindestroy(void)
 	xcb_disconnect(conn);
 }
 
+/*
+ * Handlers never render by themselves, they only ask for the canvas and/or
+ * an overlay to be redrawn. The requests are coalesced into a single frame
+ * once the event queue is drained (see next_event).
+ */
 static void
-brush_preview_render(void)
+schedule_redraw(Redraw what)
 {
-	canvas_render(canvas);
-
-	xcb_poly_arc(conn, win, brush_preview_gc, 1, (const xcb_arc_t []) {{
-		.x = drawinfo.mouse_pos.x - drawinfo.brush_size,
-		.y = drawinfo.mouse_pos.y - drawinfo.brush_size,
-		.width = drawinfo.brush_size*2,
-		.height = drawinfo.brush_size*2,
-		.angle1 = 0 << 6,
-		.angle2 = 360 << 6
-	}});
-
-	xcb_flush(conn);
+	if (frameinfo.redraw != 0)
+		frameinfo.skipped++;
+	frameinfo.redraw |= what;
 }
 
 static void
-addpoint(int x, int y, uint32_t color, int size)
+brush_preview_render(xcb_drawable_t d)
 {
-	int dx, dy;
-	uint32_t prevcol;
+	int radius;
 
-	for (dy = -size; dy < size; ++dy) {
-		for (dx = -size; dx < size; ++dx) {
-			if (dy * dy + dx * dx >= size * size ||
-					!canvas_get_pixel(canvas, x + dx, y + dy, &prevcol))
-				continue;
-#ifdef APINT_USE_ROUGH_BRUSH
-			canvas_set_pixel(canvas, x + dx, y + dy, color);
-#else
-			canvas_set_pixel(canvas, x + dx, y + dy,
-					color_mix(color, prevcol,
-						((sqrt(dy * dy + dx * dx)*0xff) / size)));
-#endif
-		}
-	}
+	radius = MAX(1, (int)(drawinfo.brush_size * canvas_get_zoom(canvas)));
+
+	xcb_poly_arc(conn, d, brush_preview_gc, 1, (const xcb_arc_t []) {{
+		.x = drawinfo.mouse_pos.x - radius,
+		.y = drawinfo.mouse_pos.y - radius,
+		.width = radius*2,
+		.height = radius*2,
+		.angle1 = 0 << 6,
+		.angle2 = 360 << 6
+	}});
 }
 
 static void
-addsegment(int x0, int y0, int x1, int y1, uint32_t color, int size)
+addpolyline(const HistoryPoint *points, int npoints, uint32_t color, int size)
 {
-	int dx = x1 - x0;
-	int dy = y1 - y0;
-	float dist = sqrtf((float)(dx*dx + dy*dy));
-	if (dist <= 0.0f) {
-		return;
-	}
-
-	float spacing = size * APINT_STROKE_SPACING_FACTOR;
-	if (spacing < 1.0f) spacing = 1.0f;
-
-	int steps = (int)ceilf(dist / spacing);
-	float stepx = dx / (float)steps;
-	float stepy = dy / (float)steps;
+	Stroke *s;
+	int i;
 
-	for (int i = 1; i <= steps; ++i) {
-		int xi = (int)lroundf(x0 + stepx * i);
-		int yi = (int)lroundf(y0 + stepy * i);
-		addpoint(xi, yi, color, size);
-	}
+	s = stroke_new(canvas, color, size);
+	for (i = 0; i < npoints; ++i)
+		stroke_add_point(s, points[i].x, points[i].y);
+	stroke_free(s);
 }
 
 static void
-fill_hspan(int xa, int xb, int y, uint32_t color, int size)
+draw_rect(int x0, int y0, int x1, int y1, uint32_t color, int size, bool fill)
 {
-	int x;
+	if (x0 > x1) { int t = x0; x0 = x1; x1 = t; }
+	if (y0 > y1) { int t = y0; y0 = y1; y1 = t; }
 
-	if (xa > xb) {
-		int t = xa; xa = xb; xb = t;
-	}
+	if (fill)
+		canvas_fill_rect(canvas, x0, y0, x1 - x0 + 1, y1 - y0 + 1, color);
 
-	for (x = xa; x <= xb; x += size)
-		addpoint(x, y, color, size);
-	addpoint(xb, y, color, size);
+	addpolyline((HistoryPoint[]) {
+		{ x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y1 }, { x0, y0 }
+	}, 5, color, size);
 }
 
-static void
-draw_rect(int x0, int y0, int x1, int y1, uint32_t color, int size, bool fill)
+/*
+ * Points of the first quadrant of the ellipse centered at the origin with
+ * semi-axes rx and ry, from (0, ry) to (rx, 0), found with the midpoint
+ * algorithm. Consecutive points are 8-connected. Returns how many were
+ * stored in `pts`, which needs room for rx + ry + 1 of them.
+ */
+static int
+ellipse_quadrant(int rx, int ry, HistoryPoint *pts)
 {
-	int y;
+	int64_t rx2, ry2, px, py, p;
+	int x, y, n;
+
+	rx2 = (int64_t)(rx) * rx;
+	ry2 = (int64_t)(ry) * ry;
+	x = 0;
+	y = ry;
+	px = 0;
+	py = 2 * rx2 * y;
+	n = 0;
+
+	pts[n++] = (HistoryPoint) { x, y };
+
+	/* region 1, where the slope is above -1: x always advances */
+	p = 4 * ry2 - 4 * rx2 * ry + rx2;
+	while (px < py) {
+		++x;
+		px += 2 * ry2;
+		if (p < 0) {
+			p += 4 * (ry2 + px);
+		} else {
+			--y;
+			py -= 2 * rx2;
+			p += 4 * (ry2 + px - py);
+		}
+		pts[n++] = (HistoryPoint) { x, y };
+	}
 
-	if (x0 > x1) { int t = x0; x0 = x1; x1 = t; }
-	if (y0 > y1) { int t = y0; y0 = y1; y1 = t; }
+	/* region 2, where y always goes down */
+	p = ry2 * (2 * x + 1) * (2 * x + 1) + 4 * rx2 * (int64_t)(y - 1) * (y - 1) -
+		4 * rx2 * ry2;
+	while (y > 0) {
+		--y;
+		py -= 2 * rx2;
+		if (p > 0) {
+			p += 4 * (rx2 - py);
+		} else {
+			++x;
+			px += 2 * ry2;
+			p += 4 * (rx2 - py + px);
+		}
+		pts[n++] = (HistoryPoint) { x, y };
+	}
 
-	if (fill)
-		for (y = y0; y <= y1; y += size)
-			fill_hspan(x0, x1, y, color, size);
+	/* very flat ellipses can reach the axis early */
+	while (x < rx)
+		pts[n++] = (HistoryPoint) { ++x, 0 };
 
-	addsegment(x0, y0, x1, y0, color, size);
-	addsegment(x1, y0, x1, y1, color, size);
-	addsegment(x1, y1, x0, y1, color, size);
-	addsegment(x0, y1, x0, y0, color, size);
+	return n;
 }
 
 static void
 draw_ellipse(int x0, int y0, int x1, int y1, uint32_t color, int size, bool fill)
 {
-	int cx, cy, rx, ry, i, steps;
-	int px = 0, py = 0;
-	float t, hw, k;
+	HistoryPoint *pts, p;
+	int cx, cy, rx, ry, i, q, n, lx, ly, step2;
+	Stroke *s;
 
 	cx = (x0 + x1) / 2;
 	cy = (y0 + y1) / 2;
@@ -336,83 +404,89 @@ draw_ellipse(int x0, int y0, int x1, int y1, uint32_t color, int size, bool fill
 	if (rx <= 0 || ry <= 0)
 		return;
 
+	pts = xmalloc((rx + ry + 1) * sizeof(HistoryPoint));
+	n = ellipse_quadrant(rx, ry, pts);
+
+	/* the widest point of each row bounds its span */
 	if (fill) {
-		int dy;
-		for (dy = -ry; dy <= ry; dy += size) {
-			k = 1.0f - (float)(dy * dy) / (float)(ry * ry);
-			if (k < 0.0f) k = 0.0f;
-			hw = rx * sqrtf(k);
-			fill_hspan(cx - (int)hw, cx + (int)hw, cy + dy, color, size);
+		for (i = 0; i < n; ++i) {
+			if (i + 1 < n && pts[i + 1].y == pts[i].y)
+				continue;
+			canvas_fill_hspan(canvas, cx - pts[i].x, cx + pts[i].x, cy + pts[i].y, color);
+			if (pts[i].y != 0)
+				canvas_fill_hspan(canvas, cx - pts[i].x, cx + pts[i].x, cy - pts[i].y, color);
 		}
 	}
 
-	steps = (int)(2.0f * 3.14159265f * (rx > ry ? rx : ry));
-	if (steps < 16) steps = 16;
-
-	for (i = 0; i <= steps; ++i) {
-		t = (2.0f * 3.14159265f * i) / steps;
-		int nx = cx + (int)lroundf(rx * cosf(t));
-		int ny = cy + (int)lroundf(ry * sinf(t));
-		if (i > 0)
-			addsegment(px, py, nx, ny, color, size);
-		px = nx; py = ny;
+	/* walk the four quadrants as one closed polyline, skipping
+	 * the points closer than sqrt(2 * r) to the last one kept,
+	 * whose chords stay within a quarter pixel of the curve */
+	step2 = 2 * MIN(rx, ry);
+	s = stroke_new(canvas, color, size);
+	lx = ly = 0;
+
+	for (q = 0; q < 4; ++q) {
+		for (i = 0; i < n; ++i) {
+			p = pts[(q & 1) ? n - 1 - i : i];
+			p.x = cx + ((q & 2) ? -p.x : p.x);
+			p.y = cy + ((q == 0 || q == 3) ? p.y : -p.y);
+			if ((q > 0 || i > 0) && (q < 3 || i < n - 1) &&
+					(p.x - lx) * (p.x - lx) + (p.y - ly) * (p.y - ly) < step2)
+				continue;
+			stroke_add_point(s, p.x, p.y);
+			lx = p.x;
+			ly = p.y;
+		}
 	}
+
+	stroke_free(s);
+	free(pts);
 }
 
 static void
 draw_triangle(int x0, int y0, int x1, int y1, uint32_t color, int size, bool fill)
 {
-	int apexx, apexy, blx, bly, brx, bry, y, step;
-	float t;
+	int apexx, apexy, blx, bly, brx, bry, y, dy, h, lx, rx;
 
 	apexx = (x0 + x1) / 2;
 	apexy = y0;
 	blx = x0; bly = y1;
 	brx = x1; bry = y1;
 
+	/* walk both edges from the apex towards the base, regardless
+	 * of whether the triangle was drawn top-down or bottom-up */
 	if (fill && bly != apexy) {
-		/* interpolate from the apex towards the base, regardless of
-		 * whether the triangle was drawn top-down or bottom-up */
-		step = (bly > apexy) ? size : -size;
-		for (y = apexy; (step > 0) ? (y <= bly) : (y >= bly); y += step) {
-			t = (float)(y - apexy) / (float)(bly - apexy);
-			int lx = apexx + (int)((blx - apexx) * t);
-			int rx = apexx + (int)((brx - apexx) * t);
-			fill_hspan(lx, rx, y, color, size);
+		h = abs(bly - apexy);
+		for (dy = 0; dy <= h; ++dy) {
+			y = apexy + (bly > apexy ? dy : -dy);
+			lx = apexx + (blx - apexx) * dy / h;
+			rx = apexx + (brx - apexx) * dy / h;
+			canvas_fill_hspan(canvas, MIN(lx, rx), MAX(lx, rx), y, color);
 		}
 	}
 
-	addsegment(apexx, apexy, blx, bly, color, size);
-	addsegment(blx, bly, brx, bry, color, size);
-	addsegment(brx, bry, apexx, apexy, color, size);
+	addpolyline((HistoryPoint[]) {
+		{ apexx, apexy }, { blx, bly }, { brx, bry }, { apexx, apexy }
+	}, 4, color, size);
 }
 
-static void flood_fill(int sx, int sy, uint32_t newcolor);
 
 /*
- * Paint a single user action onto the canvas. Used both when the action is
- * first performed and when rebuilding the canvas from history. It only draws;
- * it records nothing.
+ * Paint a single user action onto the canvas. Runs on the raster thread when
+ * the action is first performed, and on this one when rebuilding the canvas
+ * from history. It only draws; it records nothing.
  */
 static void
 replay_action(const HistoryUserAction *a)
 {
-	int i;
-
 	switch (a->type) {
 	case HISTORY_STROKE:
-		if (a->stroke.npoints > 0)
-			addpoint(a->stroke.points[0].x, a->stroke.points[0].y,
-					a->color, a->size);
-		for (i = 1; i < a->stroke.npoints; ++i)
-			addsegment(a->stroke.points[i-1].x, a->stroke.points[i-1].y,
-					a->stroke.points[i].x, a->stroke.points[i].y,
-					a->color, a->size);
+		addpolyline(a->stroke.points, a->stroke.npoints, a->color, a->size);
 		break;
 	case HISTORY_LINE:
-		addpoint(a->shape.x0, a->shape.y0, a->color, a->size);
-		addsegment(a->shape.x0, a->shape.y0, a->shape.x1, a->shape.y1,
-				a->color, a->size);
+		addpolyline((HistoryPoint[]) {
+			{ a->shape.x0, a->shape.y0 }, { a->shape.x1, a->shape.y1 }
+		}, 2, a->color, a->size);
 		break;
 	case HISTORY_RECTANGLE:
 		draw_rect(a->shape.x0, a->shape.y0, a->shape.x1, a->shape.y1,
@@ -427,111 +501,223 @@ replay_action(const HistoryUserAction *a)
 				a->color, a->size, a->shape.fill);
 		break;
 	case HISTORY_FILL:
-		flood_fill(a->bucket.x, a->bucket.y, a->color);
+		fill_flood(canvas, a->bucket.x, a->bucket.y, a->color);
 		break;
 	}
 }
 
+#ifdef APINT_HISTORY
+static void
+checkpoint_free(void *cp)
+{
+	/* the raster thread could be copying a tile that
+	 * shares its pixels with the checkpoint */
+	raster_lock(raster);
+	canvas_checkpoint_free(canvas, cp);
+	raster_unlock(raster);
+}
+
 /*
- * Scanline flood fill. Only touches canvas pixels; it records nothing and
- * does not render, so it can be reused both for the initial fill and when
- * replaying a fill action from history.
+ * Keep the pixels of the canvas as they are right after `hua`, which has
+ * to be the last action painted.
  */
 static void
-flood_fill(int sx, int sy, uint32_t newcolor)
+checkpoint_take(HistoryUserAction *hua)
 {
-	uint32_t target, c;
-	int *stack;
-	size_t top, cap;
-	int x, y, lx, rx, i, ny, dir;
+	history_add_checkpoint(hist, hua, canvas_checkpoint_new(canvas));
+}
 
-	if (!canvas_get_pixel(canvas, sx, sy, &target))
-		return;
+static void
+delta_free(void *d)
+{
+	raster_lock(raster);
+	canvas_delta_free(canvas, d);
+	raster_unlock(raster);
+}
 
-	if (target == newcolor)
-		return;
+/*
+ * Keep the tiles changed by `hua`, the last action painted, so it can be
+ * undone and redone without replaying anything.
+ */
+static void
+delta_take(HistoryUserAction *hua)
+{
+	CanvasDelta *d;
+
+	if (use_deltas && NULL != (d = canvas_delta_take(canvas)))
+		history_add_delta(hist, hua, d);
+}
+
+/*
+ * Make the deltas start from the canvas as it is now, after something
+ * that isn't an action of its own changed it.
+ */
+static void
+delta_reset(void)
+{
+	if (use_deltas)
+		canvas_delta_reset(canvas);
+}
+
+/*
+ * Bytes the history takes: the actions, and the pixels of their
+ * checkpoints and deltas the canvas no longer shares, packing the ones it
+ * let go of since the last sweep.
+ */
+static size_t
+history_sweep(void)
+{
+	raster_lock(raster);
+	canvas_history_sweep(canvas);
+	canvas_get_history_stats(canvas, &hist_stats);
+	raster_unlock(raster);
+
+	return hist->size + hist_stats.packed;
+}
 
-	cap = 256;
-	top = 0;
-	stack = xmalloc(cap * 2 * sizeof(int));
-	stack[top*2] = sx; stack[top*2+1] = sy; ++top;
+static void
+history_info(void)
+{
+	size_t used;
 
-	while (top > 0) {
-		--top;
-		x = stack[top*2]; y = stack[top*2+1];
+	used = history_sweep();
 
-		if (!canvas_get_pixel(canvas, x, y, &c) || c != target)
-			continue;
+	info("history: %zu of %d MiB, pixels packed %zu -> %zu KiB (%.1fx)",
+			used >> 20, history_budget_mb,
+			hist_stats.raw >> 10, hist_stats.packed >> 10,
+			hist_stats.packed > 0 ? (double)(hist_stats.raw) / hist_stats.packed : 1.0);
+}
 
-		/* grow the span to its left and right limits */
-		lx = x;
-		while (canvas_get_pixel(canvas, lx - 1, y, &c) && c == target)
-			--lx;
-		rx = x;
-		while (canvas_get_pixel(canvas, rx + 1, y, &c) && c == target)
-			++rx;
-
-		for (i = lx; i <= rx; ++i)
-			canvas_set_pixel(canvas, i, y, newcolor);
-
-		/* seed contiguous runs of the target color on the rows above
-		 * and below the span we just filled */
-		for (dir = -1; dir <= 1; dir += 2) {
-			ny = y + dir;
-			i = lx;
-			while (i <= rx) {
-				if (!canvas_get_pixel(canvas, i, ny, &c) || c != target) {
-					++i;
-					continue;
-				}
-				while (i <= rx && canvas_get_pixel(canvas, i, ny, &c) &&
-						c == target)
-					++i;
-				if (top >= cap) {
-					cap *= 2;
-					stack = xrealloc(stack, cap * 2 * sizeof(int));
-				}
-				stack[top*2] = i - 1; stack[top*2+1] = ny; ++top;
-			}
+/*
+ * Keep the history within its budget: the actions up to the oldest
+ * checkpoint (not past the current action) are folded into what the
+ * canvas is cleared to, and once there are none left to fold, the
+ * oldest deltas are dropped.
+ */
+static void
+history_trim(void)
+{
+	HistoryUserAction *hua, *fold;
+
+	while (history_sweep() > (size_t)(history_budget_mb) << 20) {
+		for (fold = NULL, hua = hist->root; NULL == fold && hua != hist->current; ) {
+			hua = hua->next;
+			if (NULL != hua->checkpoint)
+				fold = hua;
 		}
-	}
 
-	free(stack);
+		if (NULL != fold) {
+			raster_lock(raster);
+			canvas_checkpoint_fold(canvas, fold->checkpoint);
+			raster_unlock(raster);
+			history_fold(hist, fold);
+		} else if (!history_drop_oldest_delta(hist)) {
+			break;
+		}
+	}
 }
+#endif
 
 /*
  * Either store the action in the undo history or, when history is disabled,
- * free it (it has already been painted by the caller).
+ * free it (the raster thread paints a copy of it).
  */
 static void
 record_action(HistoryUserAction *a)
 {
 #ifdef APINT_HISTORY
 	history_do(hist, a);
+	/* all need the action to be painted */
+	if (use_deltas || history_wants_checkpoint(hist)) {
+		raster_sync(raster);
+		delta_take(a);
+		if (history_wants_checkpoint(hist))
+			checkpoint_take(a);
+		history_trim();
+	}
 #else
 	history_user_action_destroy(a);
 #endif
 }
 
+/*
+ * Fills are painted here a slice per round of the event loop, so the
+ * window keeps redrawing and the fill can still be cancelled. They reach
+ * the history only once they are done.
+ */
 static void
-fillbucket(int sx, int sy, uint32_t newcolor)
+fill_job_done(void)
 {
-	uint32_t target;
 	HistoryUserAction *a;
 
-	if (!canvas_get_pixel(canvas, sx, sy, &target) || target == newcolor)
-		return;
-
 	a = history_user_action_new();
 	a->type = HISTORY_FILL;
-	a->color = newcolor;
-	a->bucket.x = sx;
-	a->bucket.y = sy;
+	a->color = filljob.color;
+	a->bucket.x = filljob.x;
+	a->bucket.y = filljob.y;
 
-	replay_action(a);
 	record_action(a);
 
-	canvas_render(canvas);
+	fill_free(filljob.fill);
+	filljob.fill = NULL;
+	toolbar_set_progress(toolbar, -1.0f);
+}
+
+static void
+fill_job_step(size_t max_pixels)
+{
+	float progress;
+
+	if (fill_step(filljob.fill, max_pixels))
+		fill_job_done();
+	else if ((progress = fill_progress(filljob.fill)) < 0)
+		toolbar_pulse_progress(toolbar);
+	else
+		toolbar_set_progress(toolbar, progress);
+
+	schedule_redraw(REDRAW_CANVAS);
+}
+
+/*
+ * Paint what is left of the fill, anything else that touches the canvas
+ * has to come after it.
+ */
+static void
+fill_job_finish(void)
+{
+	if (NULL != filljob.fill)
+		fill_job_step(SIZE_MAX);
+}
+
+static void
+fill_job_cancel(void)
+{
+	if (NULL == filljob.fill)
+		return;
+
+	fill_rollback(filljob.fill);
+	fill_free(filljob.fill);
+	filljob.fill = NULL;
+#ifdef APINT_HISTORY
+	delta_reset();
+#endif
+	toolbar_set_progress(toolbar, -1.0f);
+	schedule_redraw(REDRAW_CANVAS);
+}
+
+static void
+fillbucket(int sx, int sy, uint32_t newcolor)
+{
+	raster_sync(raster);
+
+	if (NULL == (filljob.fill = fill_new(canvas, sx, sy, newcolor)))
+		return;
+
+	filljob.x = sx;
+	filljob.y = sy;
+	filljob.color = newcolor;
+
+	fill_job_step(APINT_FILL_STEP_PIXELS);
 }
 
 static void
@@ -562,39 +748,37 @@ commit_shape(void)
 	a->shape.x1 = x1; a->shape.y1 = y1;
 	a->shape.fill = drawinfo.fill_mode;
 
-	replay_action(a);
+	raster_replay(raster, a);
 	record_action(a);
 
-	canvas_render(canvas);
+	schedule_redraw(REDRAW_CANVAS);
 }
 
 static void
-shape_preview_render(void)
+shape_preview_render(xcb_drawable_t d)
 {
 	int x0 = shapeinfo.start_vx, y0 = shapeinfo.start_vy;
 	int x1 = shapeinfo.cur_vx, y1 = shapeinfo.cur_vy;
 
-	canvas_render(canvas);
-
 	switch (drawinfo.tool) {
 	case TOOL_LINE:
-		xcb_poly_line(conn, XCB_COORD_MODE_ORIGIN, win, shape_preview_gc, 2,
+		xcb_poly_line(conn, XCB_COORD_MODE_ORIGIN, d, shape_preview_gc, 2,
 				(const xcb_point_t []){{ x0, y0 }, { x1, y1 }});
 		break;
 	case TOOL_RECTANGLE:
-		xcb_poly_rectangle(conn, win, shape_preview_gc, 1,
+		xcb_poly_rectangle(conn, d, shape_preview_gc, 1,
 				(const xcb_rectangle_t []){{
 					MIN(x0, x1), MIN(y0, y1),
 					abs(x1 - x0), abs(y1 - y0) }});
 		break;
 	case TOOL_ELLIPSE:
-		xcb_poly_arc(conn, win, shape_preview_gc, 1, (const xcb_arc_t []){{
+		xcb_poly_arc(conn, d, shape_preview_gc, 1, (const xcb_arc_t []){{
 			.x = MIN(x0, x1), .y = MIN(y0, y1),
 			.width = abs(x1 - x0), .height = abs(y1 - y0),
 			.angle1 = 0, .angle2 = 360 << 6 }});
 		break;
 	case TOOL_TRIANGLE:
-		xcb_poly_line(conn, XCB_COORD_MODE_ORIGIN, win, shape_preview_gc, 4,
+		xcb_poly_line(conn, XCB_COORD_MODE_ORIGIN, d, shape_preview_gc, 4,
 				(const xcb_point_t []){
 					{ (x0 + x1) / 2, y0 },
 					{ x0, y1 }, { x1, y1 },
@@ -603,37 +787,209 @@ shape_preview_render(void)
 	default:
 		break;
 	}
+}
+
+/*
+ * Overlays are drawn on top of the canvas, onto the drawable the frame is
+ * being rendered to. The canvas is invalidated before and after drawing
+ * them, so the previous one gets wiped and the next render does not only
+ * present the damaged pixels.
+ */
+static bool
+frame_render(void)
+{
+	unsigned overlays;
+	xcb_drawable_t d;
+
+	/* don't wait for the raster thread to let go of the
+	 * canvas, the frame is tried again a bit later */
+	if (!raster_trylock(raster))
+		return false;
+
+	overlays = frameinfo.redraw & (REDRAW_BRUSH_PREVIEW | REDRAW_SHAPE_PREVIEW);
+
+	if (shapeinfo.active)
+		overlays |= REDRAW_SHAPE_PREVIEW;
+
+	if (overlays)
+		canvas_invalidate(canvas);
+
+	if (XCB_NONE == (d = canvas_begin_frame(canvas))) {
+		raster_unlock(raster);
+		return true;
+	}
+
+	if (overlays & REDRAW_BRUSH_PREVIEW)
+		brush_preview_render(d);
+
+	if (overlays & REDRAW_SHAPE_PREVIEW)
+		shape_preview_render(d);
+
+	canvas_end_frame(canvas);
+	raster_unlock(raster);
+
+	if (overlays)
+		canvas_invalidate(canvas);
 
 	xcb_flush(conn);
+	timespec_get(&frameinfo.last, TIME_UTC);
+	frameinfo.redraw = 0;
+	frameinfo.presented++;
+
+	return true;
+}
+
+/*
+ * Milliseconds left before the next frame can be presented
+ * without going over the maximum frame rate.
+ */
+static int
+frame_delay(void)
+{
+	struct timespec now;
+	long elapsed;
+
+	timespec_get(&now, TIME_UTC);
+
+	elapsed = (now.tv_sec - frameinfo.last.tv_sec) * 1000 +
+		(now.tv_nsec - frameinfo.last.tv_nsec) / 1000000;
+
+	return MAX(0, 1000 / frameinfo.max_fps - elapsed);
+}
+
+/*
+ * Wait for the next event, presenting a frame in between if something
+ * asked for a redraw, the queue is empty and the canvas is not waiting
+ * for the previous frame to reach the screen. The raster thread asks
+ * for a redraw whenever it has painted something.
+ */
+static xcb_generic_event_t *
+next_event(void)
+{
+	xcb_generic_event_t *ev;
+	struct pollfd pfd[2];
+	int timeout;
+
+	if (NULL != queued_event) {
+		ev = queued_event;
+		queued_event = NULL;
+		return ev;
+	}
+
+	while (NULL == (ev = xcb_poll_for_event(conn))) {
+		if (xcb_connection_has_error(conn))
+			return NULL;
+
+		timeout = -1;
+
+		if (NULL != filljob.fill)
+			fill_job_step(APINT_FILL_STEP_PIXELS);
+
+		if (frameinfo.redraw != 0 && canvas_can_render(canvas) &&
+				(timeout = frame_delay()) == 0) {
+			if (frame_render())
+				continue;
+			timeout = 1;
+		}
+
+		/* only look for events between the slices */
+		if (NULL != filljob.fill)
+			timeout = 0;
+
+		pfd[0].fd = xcb_get_file_descriptor(conn);
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		pfd[1].fd = raster_get_fd(raster);
+		pfd[1].events = POLLIN;
+		pfd[1].revents = 0;
+
+		poll(pfd, 2, timeout);
+
+		if ((pfd[1].revents & POLLIN) && raster_take_damage(raster))
+			schedule_redraw(REDRAW_CANVAS);
+	}
+
+	return ev;
 }
 
 #ifdef APINT_HISTORY
+/*
+ * Bring the canvas to the current action: restore the last checkpoint
+ * before it and replay what follows. A tail that takes long to replay
+ * gets checkpoints of its own along the way, so it is only slow once.
+ */
 static void
 regenfromhist(void)
 {
 	HistoryUserAction *hua;
+	struct timespec t0, t1;
+	long cost;
+
+	if (NULL != (hua = history_last_checkpoint(hist, hist->current))) {
+		canvas_checkpoint_restore(canvas, hua->checkpoint);
+		hua = hua->next;
+	} else {
+		canvas_clear(canvas);
+		hua = hist->root;
+	}
 
-	for (hua = hist->root; hua != hist->current->next; hua = hua->next)
+	for (cost = 0; hua != hist->current->next; hua = hua->next) {
+		timespec_get(&t0, TIME_UTC);
 		replay_action(hua);
+		timespec_get(&t1, TIME_UTC);
+		cost += (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec);
+		if (cost >= APINT_CHECKPOINT_COST_NS && hua != hist->root) {
+			checkpoint_take(hua);
+			cost = 0;
+		}
+	}
+
+	delta_reset();
+
+	/* the checkpoints taken on the way count against the budget too */
+	history_trim();
 }
 
 static void
 undo(void)
 {
+	HistoryUserAction *a;
+
+	/* the fill isn't in the history yet, undoing it
+	 * is cancelling it */
+	if (NULL != filljob.fill) {
+		fill_job_cancel();
+		return;
+	}
+
+	a = hist->current;
+
 	if (history_undo(hist)) {
-		canvas_clear(canvas);
-		regenfromhist();
-		canvas_render(canvas);
+		raster_sync(raster);
+		if (NULL != a->delta)
+			canvas_delta_undo(canvas, a->delta);
+		else
+			regenfromhist();
+		schedule_redraw(REDRAW_CANVAS);
 	}
 }
 
 static void
 redo(void)
 {
+	fill_job_finish();
+
+	/* the canvas is already right up to the action before */
 	if (history_redo(hist)) {
-		canvas_clear(canvas);
-		regenfromhist();
-		canvas_render(canvas);
+		raster_sync(raster);
+		if (NULL != hist->current->delta) {
+			canvas_delta_redo(canvas, hist->current->delta);
+		} else {
+			replay_action(hist->current);
+			delta_take(hist->current);
+			history_trim();
+		}
+		schedule_redraw(REDRAW_CANVAS);
 	}
 }
 #endif
@@ -649,6 +1005,8 @@ save(void)
 	if (NULL == (expanded_path = path_expand(path))) {
 		info("could not expand path");
 	} else if (path_is_writeable(expanded_path)) {
+		fill_job_finish();
+		raster_sync(raster);
 		canvas_save(canvas, expanded_path);
 		info("saved drawing succesfully to %s", path);
 	} else {
@@ -675,8 +1033,11 @@ h_client_message(xcb_client_message_event_t *ev)
 static void
 h_expose(xcb_expose_event_t *ev)
 {
-	(void) ev;
-	canvas_render(canvas);
+	canvas_invalidate(canvas);
+
+	/* wait for the last event of the series */
+	if (ev->count == 0)
+		schedule_redraw(REDRAW_CANVAS);
 }
 
 static void
@@ -691,16 +1052,24 @@ h_key_press(xcb_key_press_event_t *ev)
 	if (picker_is_visible(picker))
 		picker_hide(picker);
 
+	if (key == XKB_KEY_Escape) {
+		fill_job_cancel();
+		return;
+	}
+
 	if (ev->state & XCB_MOD_MASK_CONTROL) {
 		switch (key) {
 #ifdef APINT_HISTORY
 		case XKB_KEY_z: if (!drawinfo.active) undo(); return;
 		case XKB_KEY_y: if (!drawinfo.active) redo(); return;
+		case XKB_KEY_i: history_info(); return;
 #endif
 
 		case XKB_KEY_s: save(); return;
 		case XKB_KEY_g:
 			canvas_viewport_to_canvas_pos(canvas, drawinfo.mouse_pos.x, drawinfo.mouse_pos.y, &draw_position_x, &draw_position_y);
+			fill_job_finish();
+			raster_sync(raster);
 			canvas_get_pixel(canvas, draw_position_x, draw_position_y, &drawinfo.color);
 			toolbar_set_color(toolbar, drawinfo.color);
 			return;
@@ -736,13 +1105,11 @@ h_button_press(xcb_button_press_event_t *ev)
 		if (draginfo.active)
 			break;
 		picker_hide(picker);
+		fill_job_finish();
 		if (drawinfo.tool == TOOL_FREEHAND) {
 			drawinfo.active = true;
 			canvas_viewport_to_canvas_pos(canvas, ev->event_x, ev->event_y, &x, &y);
-			drawinfo.last_x = x;
-			drawinfo.last_y = y;
-			drawinfo.has_prev = true;
-			addpoint(x, y, drawinfo.color, drawinfo.brush_size);
+			raster_stroke_begin(raster, drawinfo.color, drawinfo.brush_size, x, y);
 #ifdef APINT_HISTORY
 			hist_stroke = history_user_action_new();
 			hist_stroke->type = HISTORY_STROKE;
@@ -750,7 +1117,6 @@ h_button_press(xcb_button_press_event_t *ev)
 			hist_stroke->size = drawinfo.brush_size;
 			history_user_action_push_point(hist_stroke, x, y);
 #endif
-			canvas_render(canvas);
 		} else if (drawinfo.tool == TOOL_FILLBUCKET) {
 			canvas_viewport_to_canvas_pos(canvas, ev->event_x, ev->event_y, &x, &y);
 			fillbucket(x, y, drawinfo.color);
@@ -758,7 +1124,7 @@ h_button_press(xcb_button_press_event_t *ev)
 			shapeinfo.active = true;
 			shapeinfo.start_vx = shapeinfo.cur_vx = ev->event_x;
 			shapeinfo.start_vy = shapeinfo.cur_vy = ev->event_y;
-			shape_preview_render();
+			schedule_redraw(REDRAW_SHAPE_PREVIEW);
 		}
 		break;
 	case XCB_BUTTON_INDEX_2:
@@ -775,57 +1141,106 @@ h_button_press(xcb_button_press_event_t *ev)
 		picker_show(picker, ev->event_x, ev->event_y);
 		break;
 	case XCB_BUTTON_INDEX_4:
+		if (ev->state & XCB_MOD_MASK_CONTROL) {
+			canvas_zoom(canvas, 1, ev->event_x, ev->event_y);
+			schedule_redraw(REDRAW_BRUSH_PREVIEW);
+			break;
+		}
 		if (drawinfo.brush_size < APINT_MAX_BRUSH_SIZE)
 			drawinfo.brush_size++;
 		toolbar_set_brush_size(toolbar, drawinfo.brush_size);
-		brush_preview_render();
+		schedule_redraw(REDRAW_BRUSH_PREVIEW);
 		break;
 	case XCB_BUTTON_INDEX_5:
+		if (ev->state & XCB_MOD_MASK_CONTROL) {
+			canvas_zoom(canvas, -1, ev->event_x, ev->event_y);
+			schedule_redraw(REDRAW_BRUSH_PREVIEW);
+			break;
+		}
 		if (drawinfo.brush_size > 2)
 			drawinfo.brush_size--;
 		toolbar_set_brush_size(toolbar, drawinfo.brush_size);
-		brush_preview_render();
+		schedule_redraw(REDRAW_BRUSH_PREVIEW);
 		break;
 	}
 }
 
 static void
-h_motion_notify(xcb_motion_notify_event_t *ev)
+motion_push(int x, int y)
 {
-	int x, y;
-	int dx, dy;
+	if (motion.npoints >= motion.cap) {
+		motion.cap = motion.cap ? motion.cap * 2 : 64;
+		motion.points = xrealloc(motion.points, motion.cap * sizeof(HistoryPoint));
+	}
 
-	drawinfo.mouse_pos.x = ev->event_x;
-	drawinfo.mouse_pos.y = ev->event_y;
+	motion.points[motion.npoints].x = x;
+	motion.points[motion.npoints].y = y;
+	motion.npoints++;
+}
 
-	if (draginfo.active) {
-		dx = ev->event_x - draginfo.x;
-		dy = ev->event_y - draginfo.y;
+/*
+ * Collect the position of `ev` and of the motion events of the window
+ * that are already queued behind it, so a burst of them is handled as a
+ * single update. The first event of any other kind is put aside for
+ * next_event.
+ */
+static void
+motion_collect(xcb_motion_notify_event_t *ev)
+{
+	xcb_generic_event_t *next;
+	xcb_motion_notify_event_t *mev;
 
-		draginfo.x = ev->event_x;
-		draginfo.y = ev->event_y;
+	motion.npoints = 0;
+	motion_push(ev->event_x, ev->event_y);
+
+	while (NULL != (next = xcb_poll_for_queued_event(conn))) {
+		mev = (xcb_motion_notify_event_t *)(next);
+		if ((next->response_type & ~0x80) != XCB_MOTION_NOTIFY ||
+				mev->event != win) {
+			queued_event = next;
+			break;
+		}
+		motion_push(mev->event_x, mev->event_y);
+		free(next);
+	}
+}
+
+static void
+h_motion_notify(xcb_motion_notify_event_t *ev)
+{
+	HistoryPoint *p;
+	int i, vx, vy;
+
+	motion_collect(ev);
+	vx = motion.points[motion.npoints - 1].x;
+	vy = motion.points[motion.npoints - 1].y;
 
-		canvas_move_relative(canvas, dx, dy);
-		canvas_render(canvas);
+	drawinfo.mouse_pos.x = vx;
+	drawinfo.mouse_pos.y = vy;
+
+	if (draginfo.active) {
+		canvas_move_relative(canvas, vx - draginfo.x, vy - draginfo.y);
+		draginfo.x = vx;
+		draginfo.y = vy;
+		schedule_redraw(REDRAW_CANVAS);
 	}
 
 	if (drawinfo.active) {
-		canvas_viewport_to_canvas_pos(canvas, ev->event_x, ev->event_y, &x, &y);
-		addsegment(drawinfo.last_x, drawinfo.last_y, x, y,
-				drawinfo.color, drawinfo.brush_size);
+		for (i = 0; i < motion.npoints; ++i) {
+			p = &motion.points[i];
+			canvas_viewport_to_canvas_pos(canvas, p->x, p->y, &p->x, &p->y);
 #ifdef APINT_HISTORY
-		if (NULL != hist_stroke)
-			history_user_action_push_point(hist_stroke, x, y);
+			if (NULL != hist_stroke)
+				history_user_action_push_point(hist_stroke, p->x, p->y);
 #endif
-		drawinfo.last_x = x;
-		drawinfo.last_y = y;
-		canvas_render(canvas);
+			raster_stroke_point(raster, p->x, p->y);
+		}
 	}
 
 	if (shapeinfo.active) {
-		shapeinfo.cur_vx = ev->event_x;
-		shapeinfo.cur_vy = ev->event_y;
-		shape_preview_render();
+		shapeinfo.cur_vx = vx;
+		shapeinfo.cur_vy = vy;
+		schedule_redraw(REDRAW_SHAPE_PREVIEW);
 	}
 }
 
@@ -839,11 +1254,12 @@ h_button_release(xcb_button_release_event_t *ev)
 			commit_shape();
 			break;
 		}
+		if (drawinfo.active)
+			raster_stroke_end(raster);
 		drawinfo.active = false;
-		drawinfo.has_prev = false;
 #ifdef APINT_HISTORY
 		if (NULL != hist_stroke) {
-			history_do(hist, hist_stroke);
+			record_action(hist_stroke);
 			hist_stroke = NULL;
 		}
 #endif
@@ -937,7 +1353,8 @@ h_toolbar_redo(void *ud)
 static void
 usage(void)
 {
-	puts("usage: apint [-fhv] [-l file] [-s size] [-b bg_color]");
+	puts("usage: apint [-dfghpuv] [-l file] [-s size] [-b bg_color] [-r max_fps]"
+			" [-c interval] [-m budget]");
 	exit(0);
 }
 
@@ -959,16 +1376,26 @@ main(int argc, char **argv)
 	bg = 0xffffffff;
 	width = 640, height = 480;
 	loadpath = NULL;
+	frameinfo.max_fps = APINT_DEFAULT_MAX_FPS;
+	checkpoint_interval = APINT_DEFAULT_CHECKPOINT_INTERVAL;
+	history_budget_mb = APINT_DEFAULT_HISTORY_BUDGET_MB;
 
 	while (++argv, --argc > 0) {
 		if ((*argv)[0] == '-' && (*argv)[1] != '\0' && (*argv)[2] == '\0') {
 			switch ((*argv)[1]) {
 			case 'h': usage(); break;
 			case 'v': version(); break;
+			case 'd': print_frame_stats = true; break;
 			case 'f': start_in_fullscreen = true; break;
+			case 'g': linear_blending = true; break;
+			case 'p': canvas_use_present(false); break;
+			case 'u': use_deltas = true; break;
 			case 'l': --argc; loadpath = enotnull(*++argv, "path"); break;
 			case 's': --argc; size_parse(enotnull(*++argv, "size"), &width, &height); break;
 			case 'b': --argc; color_parse(enotnull(*++argv, "bg_color"), &bg); break;
+			case 'r': --argc; frameinfo.max_fps = atoi(enotnull(*++argv, "max_fps")); break;
+			case 'c': --argc; checkpoint_interval = atoi(enotnull(*++argv, "interval")); break;
+			case 'm': --argc; history_budget_mb = atoi(enotnull(*++argv, "budget")); break;
 			default: die("invalid option %s", *argv); break;
 			}
 		} else {
@@ -979,17 +1406,26 @@ main(int argc, char **argv)
 	if (width <= 5 || height <= 5)
 		die("invalid size");
 
-	if (width > 5000)
-		die("image too wide (max-width: 5000px)");
+	if (frameinfo.max_fps <= 0 || frameinfo.max_fps > 1000)
+		die("invalid max_fps");
+
+	if (checkpoint_interval < 0)
+		die("invalid interval");
 
-	if (height > 5000)
-		die("image too tall (max-height: 5000px)");
+	if (history_budget_mb < 0)
+		die("invalid budget");
+
+	if (width > APINT_MAX_CANVAS_SIZE)
+		die("image too wide (max-width: %dpx)", APINT_MAX_CANVAS_SIZE);
+
+	if (height > APINT_MAX_CANVAS_SIZE)
+		die("image too tall (max-height: %dpx)", APINT_MAX_CANVAS_SIZE);
 
 	xwininit();
+	blend_init(linear_blending ? BLEND_LINEAR : BLEND_SRGB);
 
 	drawinfo.color = 0xff000000;
 	drawinfo.brush_size = 5;
-	drawinfo.has_prev = false;
 	drawinfo.tool = TOOL_FREEHAND;
 	drawinfo.fill_mode = false;
 
@@ -999,6 +1435,8 @@ main(int argc, char **argv)
 		canvas = canvas_load(conn, win, loadpath);
 	}
 
+	raster = raster_new(canvas, replay_action);
+
 	picker = picker_new(conn, win, h_picker_color_change);
 
 	toolbar = toolbar_new(conn, win, (ToolbarCallbacks){
@@ -1014,9 +1452,18 @@ main(int argc, char **argv)
 
 #ifdef APINT_HISTORY
 	hist = history_new();
+	history_set_checkpoints(hist, checkpoint_interval, checkpoint_free);
+	history_set_deltas(hist, delta_free);
+	delta_reset();
 #endif
 
-	while (!should_close && (ev = xcb_wait_for_event(conn))) {
+	while (!should_close && (ev = next_event())) {
+
+		// check if it is a presentation event of the canvas
+		if (canvas_try_process_event(canvas, ev)) {
+			free(ev);
+			continue;
+		}
 
 		// check if it is an event targeted to our color picker
 		if (picker_try_process_event(picker, ev)) {
@@ -1044,10 +1491,26 @@ main(int argc, char **argv)
 		free(ev);
 	}
 
+	if (NULL != filljob.fill)
+		fill_free(filljob.fill);
+
+	/* dropping the checkpoints takes the raster lock */
 #ifdef APINT_HISTORY
+	if (print_frame_stats)
+		history_info();
 	history_destroy(hist);
 #endif
 
+	raster_free(raster);
+
+	free(motion.points);
+	brush_stamp_cache_free();
+	free(queued_event);
+
+	if (print_frame_stats)
+		info("frames: %lu presented, %lu skipped",
+				frameinfo.presented, frameinfo.skipped);
+
 	canvas_free(canvas);
 	picker_free(picker);
 	toolbar_free(toolbar);
@@ -0,0 +1,507 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#include <stdint.h>
+
+#include "color.h"
+#include "blend.h"
+
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define BLEND_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*BlendOverBgFunc)(uint32_t *, const uint32_t *, const uint32_t *, int);
+typedef void (*BlendMixColorFunc)(uint32_t *, uint32_t, const uint8_t *, int);
+typedef void (*BlendMixColorConstFunc)(uint32_t *, uint32_t, uint8_t, int);
+
+static BlendOverBgFunc over_bg_impl = blend_over_bg_scalar;
+static BlendMixColorFunc mix_color_impl = blend_mix_color_scalar;
+static BlendMixColorConstFunc mix_color_const_impl = blend_mix_color_const_scalar;
+
+extern void
+blend_over_bg_scalar(uint32_t *dst, const uint32_t *src, const uint32_t *bg, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+		dst[i] = color_over(src[i], bg[i]);
+}
+
+extern void
+blend_mix_color_scalar(uint32_t *dst, uint32_t color, const uint8_t *alpha, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+		dst[i] = color_mix(color, dst[i], alpha[i]);
+}
+
+extern void
+blend_mix_color_const_scalar(uint32_t *dst, uint32_t color, uint8_t alpha, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+		dst[i] = color_mix(color, dst[i], alpha);
+}
+
+extern void
+blend_over_bg_linear_scalar(uint32_t *dst, const uint32_t *src, const uint32_t *bg, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+		dst[i] = color_over_linear(src[i], bg[i]);
+}
+
+extern void
+blend_mix_color_linear_scalar(uint32_t *dst, uint32_t color, const uint8_t *alpha, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+		dst[i] = color_mix_linear(color, dst[i], alpha[i]);
+}
+
+extern void
+blend_mix_color_const_linear_scalar(uint32_t *dst, uint32_t color, uint8_t alpha, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+		dst[i] = color_mix_linear(color, dst[i], alpha);
+}
+
+#ifdef BLEND_X86
+
+/**
+ * color_mix computes a + ((b - a) * alpha) / 255 per
+ * channel, truncating towards zero. The positive and
+ * negative differences are blended separately so that
+ * everything fits in unsigned 16 bit lanes, and the
+ * division uses (x + 1 + (x >> 8)) >> 8, which is exact
+ * for every x in [0, 255*255].
+*/
+static inline __m128i
+__div255_epu16(__m128i x)
+{
+	return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x,
+			_mm_set1_epi16(1)), _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline __m128i
+__mix_epu16(__m128i a, __m128i b, __m128i alpha)
+{
+	__m128i pos, neg;
+
+	pos = _mm_mullo_epi16(_mm_subs_epu16(b, a), alpha);
+	neg = _mm_mullo_epi16(_mm_subs_epu16(a, b), alpha);
+
+	return _mm_sub_epi16(_mm_add_epi16(a, __div255_epu16(pos)),
+			__div255_epu16(neg));
+}
+
+/**
+ * The pixels are premultiplied, so putting one over the
+ * background is src + bg * (255 - alpha) / 255 for every
+ * channel: a single product which can't go negative.
+ * The sum is saturated when packing, like color_over.
+*/
+static inline __m128i
+__over_epu16(__m128i s, __m128i b)
+{
+	__m128i k;
+
+	k = _mm_sub_epi16(_mm_set1_epi16(255), _mm_shufflehi_epi16(
+			_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)),
+			_MM_SHUFFLE(3, 3, 3, 3)));
+
+	return _mm_add_epi16(s, __div255_epu16(_mm_mullo_epi16(b, k)));
+}
+
+static void
+__blend_over_bg_sse2(uint32_t *dst, const uint32_t *src, const uint32_t *bg, int n)
+{
+	__m128i zero, s, b;
+	int i;
+
+	zero = _mm_setzero_si128();
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		s = _mm_loadu_si128((const __m128i *)(&src[i]));
+		b = _mm_loadu_si128((const __m128i *)(&bg[i]));
+
+		_mm_storeu_si128((__m128i *)(&dst[i]), _mm_packus_epi16(
+				__over_epu16(_mm_unpacklo_epi8(s, zero),
+					_mm_unpacklo_epi8(b, zero)),
+				__over_epu16(_mm_unpackhi_epi8(s, zero),
+					_mm_unpackhi_epi8(b, zero))));
+	}
+
+	blend_over_bg_scalar(&dst[i], &src[i], &bg[i], n - i);
+}
+
+/**
+ * Spread 4 alpha bytes over the channels of 4 pixels,
+ * so they unpack the same way the pixels do.
+*/
+static inline __m128i
+__alpha_px(const uint8_t *alpha)
+{
+	__m128i a;
+
+	a = _mm_cvtsi32_si128(alpha[0] | alpha[1] << 8 | alpha[2] << 16 |
+			(uint32_t)(alpha[3]) << 24);
+	a = _mm_unpacklo_epi8(a, a);
+
+	return _mm_unpacklo_epi16(a, a);
+}
+
+static void
+__blend_mix_color_sse2(uint32_t *dst, uint32_t color, const uint8_t *alpha, int n)
+{
+	__m128i zero, c, d, a;
+	int i;
+
+	zero = _mm_setzero_si128();
+	c = _mm_unpacklo_epi8(_mm_set1_epi32((int)(color)), zero);
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		d = _mm_loadu_si128((const __m128i *)(&dst[i]));
+		a = __alpha_px(&alpha[i]);
+
+		_mm_storeu_si128((__m128i *)(&dst[i]), _mm_packus_epi16(
+				__mix_epu16(c, _mm_unpacklo_epi8(d, zero),
+					_mm_unpacklo_epi8(a, zero)),
+				__mix_epu16(c, _mm_unpackhi_epi8(d, zero),
+					_mm_unpackhi_epi8(a, zero))));
+	}
+
+	blend_mix_color_scalar(&dst[i], color, &alpha[i], n - i);
+}
+
+static void
+__blend_mix_color_const_sse2(uint32_t *dst, uint32_t color, uint8_t alpha, int n)
+{
+	__m128i zero, c, d, a;
+	int i;
+
+	zero = _mm_setzero_si128();
+	c = _mm_unpacklo_epi8(_mm_set1_epi32((int)(color)), zero);
+	a = _mm_set1_epi16(alpha);
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		d = _mm_loadu_si128((const __m128i *)(&dst[i]));
+
+		_mm_storeu_si128((__m128i *)(&dst[i]), _mm_packus_epi16(
+				__mix_epu16(c, _mm_unpacklo_epi8(d, zero), a),
+				__mix_epu16(c, _mm_unpackhi_epi8(d, zero), a)));
+	}
+
+	blend_mix_color_const_scalar(&dst[i], color, alpha, n - i);
+}
+
+#define BLEND_AVX2 __attribute__((target("avx2")))
+
+BLEND_AVX2 static inline __m256i
+__div255_epu16_avx2(__m256i x)
+{
+	return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x,
+			_mm256_set1_epi16(1)), _mm256_srli_epi16(x, 8)), 8);
+}
+
+BLEND_AVX2 static inline __m256i
+__mix_epu16_avx2(__m256i a, __m256i b, __m256i alpha)
+{
+	__m256i pos, neg;
+
+	pos = _mm256_mullo_epi16(_mm256_subs_epu16(b, a), alpha);
+	neg = _mm256_mullo_epi16(_mm256_subs_epu16(a, b), alpha);
+
+	return _mm256_sub_epi16(_mm256_add_epi16(a, __div255_epu16_avx2(pos)),
+			__div255_epu16_avx2(neg));
+}
+
+BLEND_AVX2 static inline __m256i
+__over_epu16_avx2(__m256i s, __m256i b)
+{
+	__m256i k;
+
+	k = _mm256_sub_epi16(_mm256_set1_epi16(255), _mm256_shufflehi_epi16(
+			_mm256_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)),
+			_MM_SHUFFLE(3, 3, 3, 3)));
+
+	return _mm256_add_epi16(s, __div255_epu16_avx2(_mm256_mullo_epi16(b, k)));
+}
+
+BLEND_AVX2 static void
+__blend_over_bg_avx2(uint32_t *dst, const uint32_t *src, const uint32_t *bg, int n)
+{
+	__m256i zero, s, b;
+	int i;
+
+	zero = _mm256_setzero_si256();
+
+	/* unpack and pack work within each 128 bit lane,
+	 * so the pixels come back out in the same order */
+	for (i = 0; i + 8 <= n; i += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(&src[i]));
+		b = _mm256_loadu_si256((const __m256i *)(&bg[i]));
+
+		_mm256_storeu_si256((__m256i *)(&dst[i]), _mm256_packus_epi16(
+				__over_epu16_avx2(_mm256_unpacklo_epi8(s, zero),
+					_mm256_unpacklo_epi8(b, zero)),
+				__over_epu16_avx2(_mm256_unpackhi_epi8(s, zero),
+					_mm256_unpackhi_epi8(b, zero))));
+	}
+
+	__blend_over_bg_sse2(&dst[i], &src[i], &bg[i], n - i);
+}
+
+BLEND_AVX2 static void
+__blend_mix_color_avx2(uint32_t *dst, uint32_t color, const uint8_t *alpha, int n)
+{
+	__m256i zero, c, d, a;
+	int i;
+
+	zero = _mm256_setzero_si256();
+	c = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)(color)), zero);
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		d = _mm256_loadu_si256((const __m256i *)(&dst[i]));
+
+		/* one alpha per 32 bit lane, copied to its 4 bytes */
+		a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(&alpha[i])));
+		a = _mm256_or_si256(a, _mm256_slli_epi32(a, 8));
+		a = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+
+		_mm256_storeu_si256((__m256i *)(&dst[i]), _mm256_packus_epi16(
+				__mix_epu16_avx2(c, _mm256_unpacklo_epi8(d, zero),
+					_mm256_unpacklo_epi8(a, zero)),
+				__mix_epu16_avx2(c, _mm256_unpackhi_epi8(d, zero),
+					_mm256_unpackhi_epi8(a, zero))));
+	}
+
+	__blend_mix_color_sse2(&dst[i], color, &alpha[i], n - i);
+}
+
+BLEND_AVX2 static void
+__blend_mix_color_const_avx2(uint32_t *dst, uint32_t color, uint8_t alpha, int n)
+{
+	__m256i zero, c, d, a;
+	int i;
+
+	zero = _mm256_setzero_si256();
+	c = _mm256_unpacklo_epi8(_mm256_set1_epi32((int)(color)), zero);
+	a = _mm256_set1_epi16(alpha);
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		d = _mm256_loadu_si256((const __m256i *)(&dst[i]));
+
+		_mm256_storeu_si256((__m256i *)(&dst[i]), _mm256_packus_epi16(
+				__mix_epu16_avx2(c, _mm256_unpacklo_epi8(d, zero), a),
+				__mix_epu16_avx2(c, _mm256_unpackhi_epi8(d, zero), a)));
+	}
+
+	__blend_mix_color_const_sse2(&dst[i], color, alpha, n - i);
+}
+
+/**
+ * Linear light needs a table lookup per channel, only
+ * gathers make it worth vectorizing. The float math is
+ * the same as the one of color_mix_linear and friends,
+ * in the same order, so the results are identical.
+*/
+BLEND_AVX2 static inline __m256
+__to_linear_avx2(__m256i px, int shift)
+{
+	return _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_i32gather_epi32(
+			(const int *)(color_to_linear), _mm256_and_si256(_mm256_srli_epi32(px, shift),
+			_mm256_set1_epi32(0xff)), 2), _mm256_set1_epi32(0xffff)));
+}
+
+BLEND_AVX2 static inline __m256i
+__from_linear_avx2(__m256 l, int shift)
+{
+	__m256i i;
+
+	i = _mm256_srli_epi32(_mm256_cvttps_epi32(l), COLOR_LINEAR_BITS - COLOR_LINEAR_INV_BITS);
+	i = _mm256_min_epi32(i, _mm256_set1_epi32(COLOR_LINEAR_INV_SIZE - 1));
+
+	return _mm256_slli_epi32(_mm256_and_si256(_mm256_i32gather_epi32(
+			(const int *)(color_from_linear), i, 1), _mm256_set1_epi32(0xff)), shift);
+}
+
+/**
+ * color_mix_linear(color, d, alpha) for 8 pixels, `lc` has
+ * the linear red, green, blue and the alpha of the color
+ * and `f` is alpha / 255.
+*/
+BLEND_AVX2 static inline __m256i
+__mix_linear_avx2(const __m256 *lc, __m256i d, __m256 f)
+{
+	__m256 l;
+
+	l = _mm256_cvtepi32_ps(_mm256_srli_epi32(d, 24));
+
+	return _mm256_or_si256(_mm256_or_si256(
+			__from_linear_avx2(_mm256_add_ps(lc[0], _mm256_mul_ps(_mm256_sub_ps(
+				__to_linear_avx2(d, 16), lc[0]), f)), 16),
+			__from_linear_avx2(_mm256_add_ps(lc[1], _mm256_mul_ps(_mm256_sub_ps(
+				__to_linear_avx2(d, 8), lc[1]), f)), 8)), _mm256_or_si256(
+			__from_linear_avx2(_mm256_add_ps(lc[2], _mm256_mul_ps(_mm256_sub_ps(
+				__to_linear_avx2(d, 0), lc[2]), f)), 0),
+			_mm256_slli_epi32(_mm256_cvttps_epi32(_mm256_add_ps(lc[3],
+				_mm256_mul_ps(_mm256_sub_ps(l, lc[3]), f))), 24)));
+}
+
+BLEND_AVX2 static inline void
+__linear_color_avx2(uint32_t color, __m256 *lc)
+{
+	lc[0] = _mm256_set1_ps(color_to_linear[RED(color)]);
+	lc[1] = _mm256_set1_ps(color_to_linear[GREEN(color)]);
+	lc[2] = _mm256_set1_ps(color_to_linear[BLUE(color)]);
+	lc[3] = _mm256_set1_ps(ALPHA(color));
+}
+
+BLEND_AVX2 static void
+__blend_over_bg_linear_avx2(uint32_t *dst, const uint32_t *src, const uint32_t *bg, int n)
+{
+	__m256i s, b, k, a;
+	__m256 f;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		s = _mm256_loadu_si256((const __m256i *)(&src[i]));
+		b = _mm256_loadu_si256((const __m256i *)(&bg[i]));
+		k = _mm256_sub_epi32(_mm256_set1_epi32(255), _mm256_srli_epi32(s, 24));
+		f = _mm256_mul_ps(_mm256_cvtepi32_ps(k), _mm256_set1_ps(1.0f / 255));
+
+		/* MIN(255, a + bg_a * k / 255), the division is exact */
+		a = _mm256_mullo_epi32(_mm256_srli_epi32(b, 24), k);
+		a = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(a,
+				_mm256_set1_epi32(1)), _mm256_srli_epi32(a, 8)), 8);
+		a = _mm256_min_epi32(_mm256_add_epi32(a, _mm256_srli_epi32(s, 24)),
+				_mm256_set1_epi32(255));
+
+		_mm256_storeu_si256((__m256i *)(&dst[i]), _mm256_or_si256(_mm256_or_si256(
+				__from_linear_avx2(_mm256_add_ps(__to_linear_avx2(s, 16),
+					_mm256_mul_ps(__to_linear_avx2(b, 16), f)), 16),
+				__from_linear_avx2(_mm256_add_ps(__to_linear_avx2(s, 8),
+					_mm256_mul_ps(__to_linear_avx2(b, 8), f)), 8)), _mm256_or_si256(
+				__from_linear_avx2(_mm256_add_ps(__to_linear_avx2(s, 0),
+					_mm256_mul_ps(__to_linear_avx2(b, 0), f)), 0),
+				_mm256_slli_epi32(a, 24))));
+	}
+
+	blend_over_bg_linear_scalar(&dst[i], &src[i], &bg[i], n - i);
+}
+
+BLEND_AVX2 static void
+__blend_mix_color_linear_avx2(uint32_t *dst, uint32_t color, const uint8_t *alpha, int n)
+{
+	__m256 lc[4], f;
+	__m256i d;
+	int i;
+
+	__linear_color_avx2(color, lc);
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		d = _mm256_loadu_si256((const __m256i *)(&dst[i]));
+		f = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+				_mm_loadl_epi64((const __m128i *)(&alpha[i])))),
+				_mm256_set1_ps(1.0f / 255));
+
+		_mm256_storeu_si256((__m256i *)(&dst[i]), __mix_linear_avx2(lc, d, f));
+	}
+
+	blend_mix_color_linear_scalar(&dst[i], color, &alpha[i], n - i);
+}
+
+BLEND_AVX2 static void
+__blend_mix_color_const_linear_avx2(uint32_t *dst, uint32_t color, uint8_t alpha, int n)
+{
+	__m256 lc[4], f;
+	__m256i d;
+	int i;
+
+	__linear_color_avx2(color, lc);
+	f = _mm256_set1_ps(alpha * (1.0f / 255));
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		d = _mm256_loadu_si256((const __m256i *)(&dst[i]));
+		_mm256_storeu_si256((__m256i *)(&dst[i]), __mix_linear_avx2(lc, d, f));
+	}
+
+	blend_mix_color_const_linear_scalar(&dst[i], color, alpha, n - i);
+}
+
+#endif
+
+extern void
+blend_init(BlendSpace space)
+{
+	if (space == BLEND_LINEAR) {
+		color_linear_init();
+		over_bg_impl = blend_over_bg_linear_scalar;
+		mix_color_impl = blend_mix_color_linear_scalar;
+		mix_color_const_impl = blend_mix_color_const_linear_scalar;
+	}
+
+#ifdef BLEND_X86
+	__builtin_cpu_init();
+
+	if (space == BLEND_LINEAR) {
+		if (__builtin_cpu_supports("avx2")) {
+			over_bg_impl = __blend_over_bg_linear_avx2;
+			mix_color_impl = __blend_mix_color_linear_avx2;
+			mix_color_const_impl = __blend_mix_color_const_linear_avx2;
+		}
+		return;
+	}
+
+	over_bg_impl = __blend_over_bg_sse2;
+	mix_color_impl = __blend_mix_color_sse2;
+	mix_color_const_impl = __blend_mix_color_const_sse2;
+
+	if (__builtin_cpu_supports("avx2")) {
+		over_bg_impl = __blend_over_bg_avx2;
+		mix_color_impl = __blend_mix_color_avx2;
+		mix_color_const_impl = __blend_mix_color_const_avx2;
+	}
+#endif
+}
+
+extern void
+blend_over_bg(uint32_t *dst, const uint32_t *src, const uint32_t *bg, int n)
+{
+	over_bg_impl(dst, src, bg, n);
+}
+
+extern void
+blend_mix_color(uint32_t *dst, uint32_t color, const uint8_t *alpha, int n)
+{
+	mix_color_impl(dst, color, alpha, n);
+}
+
+extern void
+blend_mix_color_const(uint32_t *dst, uint32_t color, uint8_t alpha, int n)
+{
+	mix_color_const_impl(dst, color, alpha, n);
+}
@@ -0,0 +1,98 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "brush.h"
+#include "utils.h"
+
+static BrushStamp **stamps;
+static int nstamps;
+
+static BrushStamp *
+__brush_stamp_new(int radius)
+{
+	BrushStamp *stamp;
+	int dx, dy, side;
+
+	side = 2 * radius;
+
+	stamp = xmalloc(sizeof(BrushStamp));
+	stamp->radius = radius;
+	stamp->x0 = xmalloc(side * sizeof(int));
+	stamp->x1 = xmalloc(side * sizeof(int));
+	stamp->alpha = xcalloc(side * side, 1);
+
+	for (dy = -radius; dy < radius; ++dy) {
+		stamp->x0[dy + radius] = radius;
+		stamp->x1[dy + radius] = -radius;
+		for (dx = -radius; dx < radius; ++dx) {
+			if (dy * dy + dx * dx >= radius * radius)
+				continue;
+			stamp->x0[dy + radius] = MIN(stamp->x0[dy + radius], dx);
+			stamp->x1[dy + radius] = MAX(stamp->x1[dy + radius], dx);
+			stamp->alpha[(dy + radius) * side + dx + radius] =
+				((sqrt(dy * dy + dx * dx)*0xff) / radius);
+		}
+	}
+
+	return stamp;
+}
+
+/*
+ * Stamps are built the first time a radius is used and kept until
+ * brush_stamp_cache_free is called.
+ */
+extern const BrushStamp *
+brush_stamp_get(int radius)
+{
+	int i;
+
+	if (radius >= nstamps) {
+		stamps = xrealloc(stamps, (radius + 1) * sizeof(BrushStamp *));
+		for (i = nstamps; i <= radius; ++i)
+			stamps[i] = NULL;
+		nstamps = radius + 1;
+	}
+
+	if (NULL == stamps[radius])
+		stamps[radius] = __brush_stamp_new(radius);
+
+	return stamps[radius];
+}
+
+extern void
+brush_stamp_cache_free(void)
+{
+	int i;
+
+	for (i = 0; i < nstamps; ++i) {
+		if (NULL == stamps[i])
+			continue;
+		free(stamps[i]->x0);
+		free(stamps[i]->x1);
+		free(stamps[i]->alpha);
+		free(stamps[i]);
+	}
+
+	free(stamps);
+	stamps = NULL;
+	nstamps = 0;
+}
@@ -17,53 +17,213 @@
 */
 
 #include <png.h>
+#include <math.h>
 #include <errno.h>
 #include <setjmp.h>
 #include <string.h>
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
-#include <xcb/xcb_image.h>
 #include <xcb/shm.h>
+#include <xcb/present.h>
+#include <xcb/xfixes.h>
 #include <sys/shm.h>
 #include <stdlib.h>
 #include <stdint.h>
 
 #include "log.h"
+#include "blend.h"
 #include "color.h"
 #include "canvas.h"
+#include "damage.h"
 #include "utils.h"
 
 #define SHMAT_INVALID_MEM ((void *)(-1))
 #define XIMAGE_MAX_SIZE (16*1024*1024)
+#define MARGIN_COLOR (0x1e1e1e)
+
+#define TILE_SHIFT (6)
+#define TILE_SIZE (1 << TILE_SHIFT)
+#define TILE_MASK (TILE_SIZE - 1)
+#define TILE_PIXELS (TILE_SIZE * TILE_SIZE)
+
+/* zooming out shrinks a tile down to a single pixel at most */
+#define ZOOM_MIN (-TILE_SHIFT)
+#define ZOOM_MAX (5)
+#define MIP_PIXELS ((TILE_PIXELS - 1) / 3)
+
+#define CHECKER_SIZE (9)
+#define CHECKER_PERIOD (2 * CHECKER_SIZE)
+#define CHECKER_DARK (0x646464)
+#define CHECKER_LIGHT (0x909090)
 
 typedef struct {
 	float x;
 	float y;
 } vec2f_t;
 
+/**
+ * Pixel storage shared by tiles. A tile that was never
+ * painted points to the background data of the canvas,
+ * and a tile that didn't change since the snapshot was
+ * taken points to its snapshot; it is copied on write.
+ * `mip` holds the halved versions of the pixels (32x32,
+ * 16x16, ... 1x1, one after the other), built on demand
+ * and rebuilt only after `px` changes. `opaque` is set
+ * while every pixel is known to have an alpha of 255,
+ * such pixels look the same over the checkerboard.
+ * `hrefs` counts the references held by the history, in
+ * checkpoints and deltas; when they are all the refs the
+ * canvas has no use for the pixels, and they may be kept
+ * `packed` (with `px` NULL) until they are restored.
+ * `retained` is set while the data waits for the next
+ * sweep to pack it.
+*/
+typedef struct {
+	int refs;
+	int hrefs;
+	int opaque;
+	int mip_stale;
+	int retained;
+	uint32_t *mip;
+	uint32_t *px;
+	uint8_t *packed;
+	size_t packed_size;
+} TileData;
+
+/**
+ * The raw pixels are stored in TILE_SIZE x TILE_SIZE
+ * row major tiles. `dirty` is set when the tile changes
+ * and cleared once it has been composited & presented,
+ * `gen` is bumped on every change. While deltas are
+ * tracked, `base` is the data at the end of the last
+ * delta, NULL otherwise.
+*/
+typedef struct {
+	TileData *data;
+	TileData *snapshot;
+	TileData *base;
+	uint32_t gen;
+	int dirty;
+} Tile;
+
+/**
+ * The pixels of every tile at some point, shared with
+ * the canvas (and other checkpoints) until they change.
+*/
+struct CanvasCheckpoint {
+	int ntiles;
+	TileData **data;
+};
+
+/**
+ * The tiles an action changed, with their data before
+ * and after it.
+*/
+typedef struct {
+	int index;
+	TileData *before;
+	TileData *after;
+} CanvasDeltaTile;
+
+struct CanvasDelta {
+	int ntiles;
+	CanvasDeltaTile *tiles;
+};
+
+/**
+ * A viewport sized buffer with the visual appareance of
+ * the canvas, its (0, 0) shows the display pixel (-ox, -oy)
+ * composited with the zoom `zoom`. `pending` holds the
+ * changes (in canvas coordinates) it hasn't shown yet.
+ * With the present extension there are two of them, and
+ * a `busy` one belongs to the server until it is idle.
+*/
+typedef struct {
+	uint32_t *px;
+	int width, height;
+	int ox, oy;
+	int zoom;
+	int stale;
+	int busy;
+	Damage pending;
+	struct {
+		int id;
+		xcb_shm_seg_t seg;
+		xcb_pixmap_t pixmap;
+	} x;
+} Visual;
+
 struct Canvas {
 	xcb_connection_t *conn;
 	xcb_window_t win;
 	xcb_gcontext_t gc;
-	xcb_point_t damage[2];
+	Damage damage;
 	vec2f_t pos;
 	int width, height;
 	int viewport_width;
 	int viewport_height;
-	uint32_t *px_raw;
-	uint32_t *px_visual;
-	uint32_t *px_snapshot;
+	int depth;
+	int invalid;
+	int zoom;
+	int tiles_w, tiles_h;
+	Tile *tiles;
+	TileData **retained;
+	int nretained, cap_retained;
+	CanvasHistoryStats history;
+	uint32_t span[TILE_SIZE];
 	int shm;
-	union {
-		struct {
-			int id;
-			xcb_shm_seg_t seg;
-			xcb_pixmap_t pixmap;
-		} shm;
-		xcb_image_t *image;
-	} x;
+	int nvisuals;
+	Visual visuals[2];
+	Visual *back;
+	struct {
+		int enabled;
+		uint8_t opcode;
+		xcb_present_event_t eid;
+		xcb_xfixes_region_t update;
+		int full;
+		uint32_t serial;
+		uint64_t msc;
+		int inflight;
+	} present;
 };
 
+/* whether new canvases may present through the present extension */
+static bool use_present = true;
+
+/**
+ * The two rows of the simulated alpha background, long
+ * enough to start at any column of the pattern and still
+ * cover a whole tile.
+*/
+static uint32_t checker[2][CHECKER_PERIOD + TILE_SIZE];
+
+static void
+__checker_init(void)
+{
+	int i;
+
+	for (i = 0; i < CHECKER_PERIOD + TILE_SIZE; ++i) {
+		checker[0][i] = (i / CHECKER_SIZE) % 2 == 0 ? CHECKER_DARK : CHECKER_LIGHT;
+		checker[1][i] = (i / CHECKER_SIZE) % 2 == 0 ? CHECKER_LIGHT : CHECKER_DARK;
+	}
+}
+
+static inline const uint32_t *
+__checker_row(int x, int y)
+{
+	return &checker[(y / CHECKER_SIZE) % 2][x % CHECKER_PERIOD];
+}
+
+/**
+ * Offset of the mip level `level` (1 = 32x32) inside
+ * the mip pixels of a tile.
+*/
+static inline int
+__mip_offset(int level)
+{
+	return (TILE_PIXELS - (TILE_PIXELS >> (2 * (level - 1)))) / 3;
+}
+
 /**
  * Check if the mit shm extension is supported.
  * We want to use this extension because transfering
@@ -87,366 +247,1577 @@ __x_check_mit_shm_extension(xcb_connection_t *conn)
 	return supported;
 }
 
+/**
+ * Check if the present extension is available, it lets
+ * us hand a whole pixmap to the server and have it shown
+ * on the next vertical blank instead of copying right away.
+*/
 static int
-__canvas_is_damaged(Canvas *c)
+__x_check_present_extension(xcb_connection_t *conn, uint8_t *opcode)
 {
-	if (c->damage[0].x == -1 || c->damage[1].x == -1 ||
-			c->damage[0].y == -1 || c->damage[1].y == -1) {
+	const xcb_query_extension_reply_t *ext;
+	xcb_present_query_version_reply_t *reply;
+	int supported;
+
+	ext = xcb_get_extension_data(conn, &xcb_present_id);
+
+	if (NULL == ext || !ext->present)
 		return 0;
-	}
-	return 1;
+
+	reply = xcb_present_query_version_reply(conn,
+			xcb_present_query_version(conn, 1, 0), NULL);
+	supported = NULL != reply;
+	*opcode = ext->major_opcode;
+
+	free(reply);
+
+	return supported;
 }
 
 /**
- * A damaged pixel needs to recalculate its visual
- * appareance before rendering the canvas.
+ * Check if the xfixes extension is available, the present
+ * extension takes the part of the pixmap that changed as
+ * one of its regions.
 */
-static void
-__canvas_damage(Canvas *c, int x, int y)
+static int
+__x_check_xfixes_extension(xcb_connection_t *conn)
 {
-	if (!__canvas_is_damaged(c)) {
-		c->damage[0].x = c->damage[1].x = x;
-		c->damage[0].y = c->damage[1].y = y;
-		return;
-	}
+	const xcb_query_extension_reply_t *ext;
+	xcb_xfixes_query_version_reply_t *reply;
+	int supported;
+
+	ext = xcb_get_extension_data(conn, &xcb_xfixes_id);
+
+	if (NULL == ext || !ext->present)
+		return 0;
+
+	reply = xcb_xfixes_query_version_reply(conn,
+			xcb_xfixes_query_version(conn, 2, 0), NULL);
+	supported = NULL != reply;
 
-	c->damage[0].x = MIN(c->damage[0].x, x);
-	c->damage[0].y = MIN(c->damage[0].y, y);
-	c->damage[1].x = MAX(c->damage[1].x, x);
-	c->damage[1].y = MAX(c->damage[1].y, y);
+	free(reply);
+
+	return supported;
 }
 
-static void
-__canvas_damage_full(Canvas *c)
+static inline Tile *
+__canvas_tile(const Canvas *c, int x, int y)
 {
-	__canvas_damage(c, 0, 0);
-	__canvas_damage(c, c->width-1, c->height-1);
+	return &c->tiles[(y >> TILE_SHIFT) * c->tiles_w + (x >> TILE_SHIFT)];
 }
 
-static void
-__canvas_damage_process(Canvas *c)
+static TileData *
+__tile_data_new(void)
 {
-	// simulated alpha bg
-	uint32_t color, sa;
-	int x, y;
+	TileData *d;
+	d = xmalloc(sizeof(TileData));
+	d->refs = 1;
+	d->hrefs = 0;
+	d->opaque = 0;
+	d->mip_stale = 1;
+	d->retained = 0;
+	d->mip = NULL;
+	d->px = xmalloc(TILE_PIXELS * sizeof(uint32_t));
+	d->packed = NULL;
+	d->packed_size = 0;
+	return d;
+}
 
-	if (!__canvas_is_damaged(c)) {
-		return;
-	}
+static inline TileData *
+__tile_data_ref(TileData *d)
+{
+	d->refs++;
+	return d;
+}
 
-	for (y = c->damage[0].y; y <= c->damage[1].y; ++y) {
-		for (x = c->damage[0].x; x <= c->damage[1].x; ++x) {
-			color = c->px_raw[y * c->width + x];
-			sa = ((x / 9 + y / 9) % 2 == 0 ? 0x646464 : 0x909090);
-			c->px_visual[y * c->width + x] = color_mix(sa, color, ALPHA(color));
-		}
+static inline void
+__tile_data_unref(TileData *d)
+{
+	if (NULL != d && --d->refs == 0) {
+		free(d->mip);
+		free(d->px);
+		free(d->packed);
+		free(d);
 	}
+}
 
-	c->damage[0].x = c->damage[1].x = -1;
-	c->damage[0].y = c->damage[1].y = -1;
+static inline TileData *
+__tile_data_href(TileData *d)
+{
+	d->hrefs++;
+	return __tile_data_ref(d);
 }
 
-static void
-__canvas_keep_visible(Canvas *c)
+static inline void
+__tile_data_hunref(TileData *d)
 {
-	c->pos.x = CLAMP(c->pos.x, -c->width, c->viewport_width);
-	c->pos.y = CLAMP(c->pos.y, -c->height, c->viewport_height);
+	d->hrefs--;
+	__tile_data_unref(d);
 }
 
+/**
+ * Run length encode the pixels: a 16 bit header holds
+ * the length - 1 of a run of 3 or more equal pixels,
+ * stored once, with TILE_RUN set, or of the literal
+ * pixels that follow it. Screenshots and drawings are
+ * mostly flat, so tiles shrink a lot.
+*/
+#define TILE_RUN 0x8000
+
 static void
-__canvas_fill(Canvas *c, uint32_t color)
+__tile_data_pack(TileData *d)
 {
-	int x, y;
+	uint8_t buf[TILE_PIXELS * sizeof(uint32_t) + TILE_PIXELS], *p;
+	const uint32_t *px;
+	uint16_t h;
+	int i, j, n;
+
+	px = d->px;
+	p = buf;
+
+	for (i = 0; i < TILE_PIXELS; i = j) {
+		for (n = 1; i + n < TILE_PIXELS && px[i + n] == px[i]; ++n)
+			;
+		if (n >= 3) {
+			j = i + n;
+			h = (uint16_t)(n - 1) | TILE_RUN;
+			memcpy(p, &h, sizeof(h));
+			memcpy(p + sizeof(h), &px[i], sizeof(uint32_t));
+			p += sizeof(h) + sizeof(uint32_t);
+			continue;
+		}
+		for (j = i + 1; j < TILE_PIXELS && !(j + 2 < TILE_PIXELS &&
+					px[j] == px[j + 1] && px[j] == px[j + 2]); ++j)
+			;
+		h = (uint16_t)(j - i - 1);
+		memcpy(p, &h, sizeof(h));
+		memcpy(p + sizeof(h), &px[i], (j - i) * sizeof(uint32_t));
+		p += sizeof(h) + (j - i) * sizeof(uint32_t);
+	}
 
-	for (y = 0; y < c->height; ++y)
-		for (x = 0; x < c->width; ++x)
-			c->px_raw[y*c->width+x] = color;
+	d->packed_size = p - buf;
+	d->packed = xmalloc(d->packed_size);
+	memcpy(d->packed, buf, d->packed_size);
 
-	__canvas_damage_full(c);
+	free(d->px);
+	free(d->mip);
+	d->px = NULL;
+	d->mip = NULL;
+	d->mip_stale = 1;
 }
 
 static void
-__canvas_take_snapshot(Canvas *c)
+__tile_data_unpack(TileData *d)
 {
-	free(c->px_snapshot);
-	c->px_snapshot = xmalloc(4*c->width*c->height);
-	memcpy(c->px_snapshot, c->px_raw, 4*c->width*c->height);
-}
+	const uint8_t *p;
+	uint32_t *px, v;
+	uint16_t h;
+	int i, n;
 
-static void
-__canvas_restore_snapshot(Canvas *c)
-{
-	if (NULL != c->px_snapshot) {
-		memcpy(c->px_raw, c->px_snapshot, 4*c->width*c->height);
-		__canvas_damage_full(c);
+	if (NULL == d->packed)
+		return;
+
+	px = d->px = xmalloc(TILE_PIXELS * sizeof(uint32_t));
+
+	for (p = d->packed, i = 0; i < TILE_PIXELS; i += n) {
+		memcpy(&h, p, sizeof(h));
+		p += sizeof(h);
+		n = (h & ~TILE_RUN) + 1;
+		if (h & TILE_RUN) {
+			memcpy(&v, p, sizeof(v));
+			p += sizeof(v);
+			while (n-- > 0)
+				*px++ = v;
+			n = (h & ~TILE_RUN) + 1;
+		} else {
+			memcpy(px, p, n * sizeof(uint32_t));
+			p += n * sizeof(uint32_t);
+			px += n;
+		}
 	}
+
+	free(d->packed);
+	d->packed = NULL;
+	d->packed_size = 0;
 }
 
-extern Canvas *
-canvas_new(xcb_connection_t *conn, xcb_window_t win, int w, int h, uint32_t bg)
+/**
+ * The data only the history may still need, since the
+ * canvas just let go of it, is packed on the next sweep.
+ * It's kept referenced until then.
+*/
+static void
+__canvas_retain(Canvas *c, TileData *d)
 {
-	xcb_screen_t *screen;
-	Canvas *c;
-
-	c = xcalloc(1, sizeof(Canvas));
+	if (d->retained || d->hrefs == 0 || d->refs != d->hrefs || NULL != d->packed)
+		return;
 
-	c->conn = conn;
-	c->win = win;
-	c->viewport_width = c->width = w;
-	c->viewport_height = c->height = h;
-	c->px_raw = xmalloc(w*h*4);
-	c->damage[0].x = c->damage[0].y = -1;
-	c->damage[1].x = c->damage[1].y = -1;
-	c->gc = xcb_generate_id(conn);
-	c->shm = __x_check_mit_shm_extension(conn);
+	if (c->nretained == c->cap_retained) {
+		c->cap_retained = c->cap_retained ? c->cap_retained * 2 : 64;
+		c->retained = xrealloc(c->retained, c->cap_retained * sizeof(TileData *));
+	}
 
-	screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+	d->retained = 1;
+	c->retained[c->nretained++] = __tile_data_ref(d);
+}
 
-	if (NULL == screen)
-		die("can't get default screen");
+/**
+ * Drop a reference the canvas held.
+*/
+static void
+__canvas_unref(Canvas *c, TileData *d)
+{
+	if (NULL == d || d->hrefs == 0) {
+		__tile_data_unref(d);
+		return;
+	}
 
-	xcb_create_gc(conn, c->gc, win, 0, NULL);
+	/* the history holds it too, so it stays alive */
+	d->refs--;
+	__canvas_retain(c, d);
+}
 
-	if (c->shm) {
-		c->x.shm.seg    = xcb_generate_id(conn);
-		c->x.shm.pixmap = xcb_generate_id(conn);
-		c->x.shm.id     = shmget(IPC_PRIVATE, w*h*4, IPC_CREAT|0600);
+/**
+ * Drop a reference the history held, what the history
+ * takes goes down by the data if it was packed and this
+ * was the last one.
+*/
+static void
+__canvas_hunref(Canvas *c, TileData *d)
+{
+	if (d->refs == 1 && NULL != d->packed) {
+		c->history.raw -= TILE_PIXELS * sizeof(uint32_t);
+		c->history.packed -= d->packed_size;
+	}
 
-		if (c->x.shm.id < 0)
-			die("shmget:");
+	__tile_data_hunref(d);
+}
 
-		c->px_visual = shmat(c->x.shm.id, NULL, 0);
+/**
+ * Unpack the data the canvas is about to use again, it
+ * no longer counts as taken by the history.
+*/
+static void
+__canvas_unpack(Canvas *c, TileData *d)
+{
+	if (NULL == d->packed)
+		return;
 
-		if (SHMAT_INVALID_MEM == c->px_visual) {
-			shmctl(c->x.shm.id, IPC_RMID, NULL);
-			die("shmat:");
-		}
+	c->history.raw -= TILE_PIXELS * sizeof(uint32_t);
+	c->history.packed -= d->packed_size;
+	__tile_data_unpack(d);
+}
 
-		xcb_shm_attach(conn, c->x.shm.seg, c->x.shm.id, 0);
-		shmctl(c->x.shm.id, IPC_RMID, NULL);
+/**
+ * Rebuild the mip levels of the tile data, each one
+ * averaging 2x2 blocks of the previous level. As all
+ * the pixels get read anyway, it also finds out again
+ * whether the tile is opaque.
+*/
+static void
+__tile_data_build_mip(TileData *d)
+{
+	const uint32_t *src;
+	uint32_t *dst, a;
+	int level, size, x, y;
+
+	if (NULL == d->mip)
+		d->mip = xmalloc(MIP_PIXELS * sizeof(uint32_t));
+
+	for (a = 0xff000000, x = 0; x < TILE_PIXELS; ++x)
+		a &= d->px[x];
+
+	d->opaque = ALPHA(a) == 0xff;
+	src = d->px;
+
+	for (level = 1; level <= TILE_SHIFT; ++level, src = dst) {
+		dst = &d->mip[__mip_offset(level)];
+		size = TILE_SIZE >> level;
+		for (y = 0; y < size; ++y)
+			for (x = 0; x < size; ++x)
+				dst[y*size+x] = color_average(
+						src[(2*y)*(2*size)+2*x], src[(2*y)*(2*size)+2*x+1],
+						src[(2*y+1)*(2*size)+2*x], src[(2*y+1)*(2*size)+2*x+1]);
+	}
 
-		xcb_shm_create_pixmap(
-			conn, c->x.shm.pixmap, win, w, h,
-			screen->root_depth,
-			c->x.shm.seg, 0
-		);
-	} else {
-		if (w*h*4 > XIMAGE_MAX_SIZE)
-			die("xcb_image_t can't handle images larger than 16MB");
+	d->mip_stale = 0;
+}
 
-		c->px_visual = xmalloc(w*h*4);
+static inline const uint32_t *
+__tile_px(const Tile *t, int x, int y)
+{
+	return &t->data->px[((y & TILE_MASK) << TILE_SHIFT) | (x & TILE_MASK)];
+}
 
-		c->x.image = xcb_image_create_native(
-			conn, w, h, XCB_IMAGE_FORMAT_Z_PIXMAP,
-			screen->root_depth, c->px_visual,
-			w*h*4, (uint8_t *)(c->px_visual)
-		);
+/**
+ * Get a writable pointer to the pixel (x, y) of the
+ * tile, making a private copy of shared pixel data
+ * first, and flag the tile as changed.
+*/
+static uint32_t *
+__tile_px_w(Canvas *c, Tile *t, int x, int y)
+{
+	TileData *d;
+
+	if (t->data->refs > 1) {
+		d = __tile_data_new();
+		d->opaque = t->data->opaque;
+		memcpy(d->px, t->data->px, TILE_PIXELS * sizeof(uint32_t));
+		__canvas_unref(c, t->data);
+		t->data = d;
 	}
 
-	__canvas_fill(c, bg);
-	__canvas_take_snapshot(c);
-	__canvas_damage_full(c);
+	t->gen++;
+	t->dirty = 1;
+	t->data->mip_stale = 1;
 
-	return c;
+	return &t->data->px[((y & TILE_MASK) << TILE_SHIFT) | (x & TILE_MASK)];
 }
 
-extern Canvas *
-canvas_load(xcb_connection_t *conn, xcb_window_t win, const char *path)
+/**
+ * A damaged pixel needs to recalculate its visual
+ * appareance before rendering the canvas.
+*/
+static void
+__canvas_damage(Canvas *c, int x, int y, int w, int h)
 {
-	FILE *fp;
-	png_struct *png;
-	png_info *pnginfo;
-	png_byte **rows, bit_depth;
-	Canvas *c;
-	int16_t x, y;
-
-	if (NULL == (fp = fopen(path, "rb")))
-		die("failed to open file %s:", path);
+	damage_add(&c->damage, x, y, w, h);
+}
 
-	if (NULL == (png = png_create_read_struct(PNG_LIBPNG_VER_STRING,
-					NULL, NULL, NULL)))
-		die("png_create_read_struct failed");
+static void
+__canvas_damage_full(Canvas *c)
+{
+	__canvas_damage(c, 0, 0, c->width, c->height);
+}
 
-	if (NULL == (pnginfo = png_create_info_struct(png)))
-		die("png_create_info_struct failed");
+/**
+ * Position of the canvas (0, 0) inside the viewport,
+ * in whole pixels.
+*/
+static inline void
+__canvas_origin(const Canvas *c, int *ox, int *oy)
+{
+	*ox = (int)floorf(c->pos.x);
+	*oy = (int)floorf(c->pos.y);
+}
 
-	if (setjmp(png_jmpbuf(png)) != 0)
-		die("aborting due to libpng error");
+/**
+ * Size of the canvas once zoomed, a partially covered
+ * display pixel counts as a whole one.
+*/
+static inline int
+__canvas_display_size(const Canvas *c, int size)
+{
+	if (c->zoom >= 0)
+		return size << c->zoom;
+	return (size + (1 << -c->zoom) - 1) >> -c->zoom;
+}
 
-	png_init_io(png, fp);
-	png_read_info(png, pnginfo);
-	c = canvas_new(conn, win, png_get_image_width(png, pnginfo),
-			png_get_image_height(png, pnginfo), 0);
+/**
+ * Map a rectangle in canvas coordinates to the display
+ * pixels (canvas coordinates once zoomed) it touches.
+*/
+static void
+__canvas_rect_to_display(const Canvas *c, const DamageRect *r, DamageRect *d)
+{
+	d->x0 = c->zoom >= 0 ? r->x0 << c->zoom : r->x0 >> -c->zoom;
+	d->y0 = c->zoom >= 0 ? r->y0 << c->zoom : r->y0 >> -c->zoom;
+	d->x1 = __canvas_display_size(c, r->x1);
+	d->y1 = __canvas_display_size(c, r->y1);
+}
 
-	bit_depth = png_get_bit_depth(png, pnginfo);
-	png_set_interlace_handling(png);
+/**
+ * Get up to `n` display pixels of row `y` starting at
+ * column `x`, without crossing a tile. Zooming out reads
+ * the mip level of the tile, zooming in repeats each
+ * pixel 2^zoom times into the span buffer of the canvas.
+*/
+static const uint32_t *
+__canvas_display_span(Canvas *c, int x, int y, int n, int *len, int *opaque)
+{
+	const uint32_t *src;
+	const Tile *t;
+	TileData *d;
+	int level, size, mask, cx, cy, i, k;
+
+	if (c->zoom == 0) {
+		t = __canvas_tile(c, x, y);
+		*len = MIN(n, TILE_SIZE - (x & TILE_MASK));
+		*opaque = t->data->opaque;
+		return __tile_px(t, x, y);
+	}
 
-	if (bit_depth == 16)
-		png_set_strip_16(png);
+	if (c->zoom < 0) {
+		level = -c->zoom;
+		size = TILE_SIZE >> level;
+		mask = size - 1;
+		d = __canvas_tile(c, x << level, y << level)->data;
 
-	if (png_get_valid(png, pnginfo, PNG_INFO_tRNS))
-		png_set_tRNS_to_alpha(png);
+		if (d->mip_stale)
+			__tile_data_build_mip(d);
 
-	switch (png_get_color_type(png, pnginfo)) {
-	case PNG_COLOR_TYPE_RGB:
-		png_set_filler(png, 0xff, PNG_FILLER_AFTER);
-		break;
-	case PNG_COLOR_TYPE_PALETTE:
-		png_set_palette_to_rgb(png);
-		png_set_filler(png, 0xff, PNG_FILLER_AFTER);
-		break;
-	case PNG_COLOR_TYPE_GRAY:
-		if (bit_depth < 8)
-			png_set_expand_gray_1_2_4_to_8(png);
-		png_set_filler(png, 0xff, PNG_FILLER_AFTER);
-		png_set_gray_to_rgb(png);
-		break;
-	case PNG_COLOR_TYPE_GRAY_ALPHA:
-		png_set_gray_to_rgb(png);
-		break;
+		*len = MIN(n, size - (x & mask));
+		*opaque = d->opaque;
+		return &d->mip[__mip_offset(level) + (y & mask) * size + (x & mask)];
 	}
 
-	png_read_update_info(png, pnginfo);
+	cx = x >> c->zoom;
+	cy = y >> c->zoom;
+	t = __canvas_tile(c, cx, cy);
+	src = __tile_px(t, cx, cy);
+	*opaque = t->data->opaque;
 
-	rows = png_malloc(png, sizeof(png_byte *) * c->height);
+	n = MIN(n, TILE_SIZE);
+	n = MIN(n, ((TILE_SIZE - (cx & TILE_MASK)) << c->zoom) - (x & ((1 << c->zoom) - 1)));
 
-	for (y = 0; y < c->height; ++y)
-		rows[y] = png_malloc(png, png_get_rowbytes(png, pnginfo));
+	for (i = 0; i < n; src++) {
+		k = MIN(n - i, ((((x + i) >> c->zoom) + 1) << c->zoom) - (x + i));
+		while (k-- > 0)
+			c->span[i++] = *src;
+	}
 
-	png_read_image(png, rows);
+	*len = n;
+	return c->span;
+}
 
-	for (y = 0; y < c->height; ++y) {
-		for (x = 0; x < c->width; ++x)
-			c->px_raw[y*c->width+x] = color_pack_from_arr(&rows[y][x*4]);
-		png_free(png, rows[y]);
+/**
+ * Recalculate the visual appareance of the display pixels
+ * of `r`, which must be inside the viewport.
+*/
+static void
+__canvas_composite(Canvas *c, Visual *v, const DamageRect *r)
+{
+	const uint32_t *src;
+	uint32_t *dst;
+	int x, y, n, opaque;
+
+	for (y = r->y0; y < r->y1; ++y) {
+		dst = &v->px[(y + v->oy) * v->width + r->x0 + v->ox];
+		for (x = r->x0; x < r->x1; x += n, dst += n) {
+			src = __canvas_display_span(c, x, y, r->x1 - x, &n, &opaque);
+			if (opaque)
+				memcpy(dst, src, n * sizeof(uint32_t));
+			else
+				blend_over_bg(dst, src, __checker_row(x, y), n);
+		}
 	}
+}
 
-	__canvas_take_snapshot(c);
-	__canvas_damage_full(c);
+/**
+ * Clip a rectangle in display coordinates to the part
+ * of the canvas that is currently inside the viewport.
+*/
+static int
+__canvas_clip_to_viewport(Canvas *c, DamageRect *r)
+{
+	int ox, oy;
 
-	png_free(png, rows);
-	png_read_end(png, NULL);
-	png_free_data(png, pnginfo, PNG_FREE_ALL, -1);
-	png_destroy_info_struct(png, &pnginfo);
-	png_destroy_read_struct(&png, NULL, NULL);
-	fclose(fp);
+	__canvas_origin(c, &ox, &oy);
 
-	return c;
+	r->x0 = MAX(r->x0, MAX(0, -ox));
+	r->y0 = MAX(r->y0, MAX(0, -oy));
+	r->x1 = MIN(r->x1, MIN(__canvas_display_size(c, c->width), c->viewport_width - ox));
+	r->y1 = MIN(r->y1, MIN(__canvas_display_size(c, c->height), c->viewport_height - oy));
+
+	return r->x0 < r->x1 && r->y0 < r->y1;
 }
 
-extern void
-canvas_save(const Canvas *c, const char *path)
+/**
+ * Fill the parts of the visual that lie outside of the
+ * canvas with the color of the window background.
+*/
+static void
+__canvas_visual_margins(Canvas *c, Visual *v)
 {
-	int x, y;
+	int x0, y0, x1, y1, x, y;
+
+	x0 = CLAMP(v->ox, 0, v->width);
+	y0 = CLAMP(v->oy, 0, v->height);
+	x1 = CLAMP(v->ox + __canvas_display_size(c, c->width), x0, v->width);
+	y1 = CLAMP(v->oy + __canvas_display_size(c, c->height), y0, v->height);
+
+	for (y = 0; y < v->height; ++y) {
+		for (x = 0; x < v->width; ++x) {
+			if (y >= y0 && y < y1 && x == x0)
+				x = x1;
+			if (x < v->width)
+				v->px[y*v->width+x] = MARGIN_COLOR;
+		}
+	}
+}
+
+/**
+ * Composite the whole canvas that is inside the viewport.
+*/
+static void
+__canvas_composite_full(Canvas *c, Visual *v)
+{
+	DamageRect r;
+
+	r = (DamageRect) { 0, 0, c->width, c->height };
+	__canvas_rect_to_display(c, &r, &r);
+
+	if (__canvas_clip_to_viewport(c, &r))
+		__canvas_composite(c, v, &r);
+
+	if (c->present.enabled)
+		__canvas_visual_margins(c, v);
+}
+
+/**
+ * Clear the dirty flag of the tiles under `r` once
+ * all the rectangles that cover them are up to date.
+*/
+static void
+__canvas_clean(Canvas *c, const DamageRect *r)
+{
+	int tx, ty;
+
+	for (ty = r->y0 >> TILE_SHIFT; ty <= (r->y1 - 1) >> TILE_SHIFT; ++ty)
+		for (tx = r->x0 >> TILE_SHIFT; tx <= (r->x1 - 1) >> TILE_SHIFT; ++tx)
+			c->tiles[ty * c->tiles_w + tx].dirty = 0;
+}
+
+static void
+__canvas_keep_visible(Canvas *c)
+{
+	c->pos.x = CLAMP(c->pos.x, -__canvas_display_size(c, c->width), c->viewport_width);
+	c->pos.y = CLAMP(c->pos.y, -__canvas_display_size(c, c->height), c->viewport_height);
+}
+
+static void
+__canvas_visual_destroy(Canvas *c, Visual *v)
+{
+	if (NULL == v->px)
+		return;
+
+	if (c->shm) {
+		xcb_shm_detach(c->conn, v->x.seg);
+		shmdt(v->px);
+		xcb_free_pixmap(c->conn, v->x.pixmap);
+	} else {
+		free(v->px);
+	}
+
+	v->px = NULL;
+}
+
+/**
+ * Composite the visual from scratch, at the current
+ * position and zoom.
+*/
+static void
+__canvas_visual_redraw(Canvas *c, Visual *v)
+{
+	__canvas_origin(c, &v->ox, &v->oy);
+	v->zoom = c->zoom;
+	v->stale = 0;
+	__canvas_composite_full(c, v);
+}
+
+/**
+ * (Re)create the visual buffer (and its shm pixmap) with
+ * the size of the viewport. Its contents are composited
+ * from scratch.
+*/
+static void
+__canvas_visual_create(Canvas *c, Visual *v)
+{
+	int w, h;
+
+	__canvas_visual_destroy(c, v);
+
+	w = v->width = MAX(1, c->viewport_width);
+	h = v->height = MAX(1, c->viewport_height);
+	v->busy = 0;
+
+	if (c->shm) {
+		v->x.seg    = xcb_generate_id(c->conn);
+		v->x.pixmap = xcb_generate_id(c->conn);
+		v->x.id     = shmget(IPC_PRIVATE, w*h*4, IPC_CREAT|0600);
+
+		if (v->x.id < 0)
+			die("shmget:");
+
+		v->px = shmat(v->x.id, NULL, 0);
+
+		if (SHMAT_INVALID_MEM == v->px) {
+			shmctl(v->x.id, IPC_RMID, NULL);
+			die("shmat:");
+		}
+
+		xcb_shm_attach(c->conn, v->x.seg, v->x.id, 0);
+		shmctl(v->x.id, IPC_RMID, NULL);
+
+		xcb_shm_create_pixmap(
+			c->conn, v->x.pixmap, c->win, w, h,
+			c->depth, v->x.seg, 0
+		);
+	} else {
+		v->px = xmalloc(w*h*4);
+	}
+
+	__canvas_visual_redraw(c, v);
+}
+
+/**
+ * Move the contents of the visual buffer to match the
+ * current position of the canvas and composite just the
+ * strips that came into view.
+*/
+static void
+__canvas_visual_scroll(Canvas *c, Visual *v)
+{
+	int ox, oy, dx, dy, y, w, h;
+	uint32_t *px;
+	DamageRect r;
+
+	__canvas_origin(c, &ox, &oy);
+
+	dx = ox - v->ox;
+	dy = oy - v->oy;
+	w = v->width;
+	h = v->height;
+	px = v->px;
+
+	if (dx == 0 && dy == 0)
+		return;
+
+	if (abs(dx) >= w || abs(dy) >= h) {
+		__canvas_visual_redraw(c, v);
+		return;
+	}
+
+	v->ox = ox;
+	v->oy = oy;
+
+	if (dy > 0) {
+		for (y = h - 1; y >= dy; --y)
+			memmove(&px[y*w+MAX(dx, 0)], &px[(y-dy)*w+MAX(-dx, 0)], (w-abs(dx))*4);
+	} else {
+		for (y = 0; y < h + dy; ++y)
+			memmove(&px[y*w+MAX(dx, 0)], &px[(y-dy)*w+MAX(-dx, 0)], (w-abs(dx))*4);
+	}
+
+	/* exposed rows, then exposed columns (viewport -> display) */
+	r = dy > 0 ? (DamageRect) { 0, 0, w, dy } : (DamageRect) { 0, h + dy, w, h };
+	r = (DamageRect) { r.x0 - ox, r.y0 - oy, r.x1 - ox, r.y1 - oy };
+
+	if (dy != 0 && __canvas_clip_to_viewport(c, &r))
+		__canvas_composite(c, v, &r);
+
+	r = dx > 0 ? (DamageRect) { 0, 0, dx, h } : (DamageRect) { w + dx, 0, w, h };
+	r = (DamageRect) { r.x0 - ox, r.y0 - oy, r.x1 - ox, r.y1 - oy };
+
+	if (dx != 0 && __canvas_clip_to_viewport(c, &r))
+		__canvas_composite(c, v, &r);
+
+	if (c->present.enabled)
+		__canvas_visual_margins(c, v);
+}
+
+static void
+__canvas_take_snapshot(Canvas *c)
+{
+	Tile *t;
+	int i;
+
+	for (i = 0; i < c->tiles_w * c->tiles_h; ++i) {
+		t = &c->tiles[i];
+		__canvas_unref(c, t->snapshot);
+		t->snapshot = __tile_data_ref(t->data);
+	}
+}
+
+/**
+ * Point the tile (tx, ty) to the pixels `d`, which it
+ * may already have.
+*/
+static void
+__canvas_restore_tile(Canvas *c, int tx, int ty, TileData *d)
+{
+	Tile *t;
+
+	t = &c->tiles[ty * c->tiles_w + tx];
+
+	if (NULL == d || t->data == d)
+		return;
+
+	__canvas_unpack(c, d);
+	__canvas_unref(c, t->data);
+	t->data = __tile_data_ref(d);
+	t->gen++;
+	t->dirty = 1;
+	__canvas_damage(c, tx << TILE_SHIFT, ty << TILE_SHIFT,
+			MIN(TILE_SIZE, c->width - (tx << TILE_SHIFT)),
+			MIN(TILE_SIZE, c->height - (ty << TILE_SHIFT)));
+}
+
+/**
+ * Only the tiles that changed since the snapshot
+ * was taken need to be restored and composited.
+*/
+static void
+__canvas_restore_snapshot(Canvas *c)
+{
+	int tx, ty;
+
+	for (ty = 0; ty < c->tiles_h; ++ty)
+		for (tx = 0; tx < c->tiles_w; ++tx)
+			__canvas_restore_tile(c, tx, ty,
+					c->tiles[ty * c->tiles_w + tx].snapshot);
+}
+
+/**
+ * Store a row of straight alpha RGBA bytes, leaving alone
+ * (and shared) the tiles whose part of the row doesn't
+ * change.
+*/
+static void
+__canvas_store_row(Canvas *c, int y, const uint8_t *row)
+{
+	const uint32_t *src;
+	uint32_t *dst;
+	uint32_t color;
+	Tile *t;
+	int x, end, i;
+
+	for (x = 0; x < c->width; x = end) {
+		t = __canvas_tile(c, x, y);
+		end = MIN(c->width, (x | TILE_MASK) + 1);
+		src = __tile_px(t, x, y);
+
+		for (i = x; i < end; ++i)
+			if (src[i - x] != color_premultiply(
+						color_pack_from_arr((uint8_t *)(&row[i*4]))))
+				break;
+
+		if (i == end)
+			continue;
+
+		for (dst = __tile_px_w(c, t, x, y); i < end; ++i) {
+			color = color_pack_from_arr((uint8_t *)(&row[i*4]));
+			dst[i - x] = color_premultiply(color);
+			t->data->opaque &= ALPHA(color) == 0xff;
+		}
+	}
+}
+
+/**
+ * Inverse of __canvas_store_row, storing back a row
+ * which was fetched leaves the pixels untouched.
+*/
+static void
+__canvas_fetch_row(const Canvas *c, int y, uint8_t *row)
+{
+	const uint32_t *src;
+	int x, end;
+
+	for (x = 0; x < c->width; x = end) {
+		end = MIN(c->width, (x | TILE_MASK) + 1);
+		src = __tile_px(__canvas_tile(c, x, y), x, y);
+		for (; x < end; ++x)
+			color_unpack_to_arr(color_unpremultiply(*src++), &row[x*4]);
+	}
+}
+
+extern void
+canvas_use_present(bool use)
+{
+	use_present = use;
+}
+
+extern Canvas *
+canvas_new(xcb_connection_t *conn, xcb_window_t win, int w, int h, uint32_t bg)
+{
+	xcb_screen_t *screen;
+	xcb_get_geometry_reply_t *geom;
+	Canvas *c;
+
+	__checker_init();
+
+	c = xcalloc(1, sizeof(Canvas));
+
+	c->conn = conn;
+	c->win = win;
+	c->viewport_width = c->width = w;
+	c->viewport_height = c->height = h;
+	c->tiles_w = (w + TILE_MASK) >> TILE_SHIFT;
+	c->tiles_h = (h + TILE_MASK) >> TILE_SHIFT;
+	c->tiles = xcalloc(c->tiles_w * c->tiles_h, sizeof(Tile));
+	c->gc = xcb_generate_id(conn);
+	c->shm = __x_check_mit_shm_extension(conn);
+	c->nvisuals = 1;
+
+	/* double buffered shm pixmaps, presented on vblank */
+	if (use_present && c->shm && __x_check_xfixes_extension(conn) &&
+			__x_check_present_extension(conn, &c->present.opcode)) {
+		c->present.enabled = 1;
+		c->present.eid = xcb_generate_id(conn);
+		c->present.update = xcb_generate_id(conn);
+		c->nvisuals = 2;
+		xcb_xfixes_create_region(conn, c->present.update, 0, NULL);
+		xcb_present_select_input(conn, c->present.eid, win,
+				XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY |
+				XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+	}
+
+	screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+
+	if (NULL == screen)
+		die("can't get default screen");
+
+	c->depth = screen->root_depth;
+	c->invalid = 1;
+
+	xcb_create_gc(conn, c->gc, win, 0, NULL);
+
+	/* the visual buffer is only allocated once the canvas
+	 * gets rendered, with the size of the window by then */
+	if (NULL != (geom = xcb_get_geometry_reply(conn,
+					xcb_get_geometry(conn, win), NULL))) {
+		canvas_set_viewport(c, geom->width, geom->height);
+		free(geom);
+	}
+
+	canvas_fill_rect(c, 0, 0, c->width, c->height, bg);
+	__canvas_take_snapshot(c);
+	__canvas_damage_full(c);
+
+	return c;
+}
+
+extern Canvas *
+canvas_load(xcb_connection_t *conn, xcb_window_t win, const char *path)
+{
+	FILE *fp;
+	png_struct *png;
+	png_info *pnginfo;
+	png_byte *row, bit_depth;
+	Canvas *c;
+	int y, pass, passes;
+
+	if (NULL == (fp = fopen(path, "rb")))
+		die("failed to open file %s:", path);
+
+	if (NULL == (png = png_create_read_struct(PNG_LIBPNG_VER_STRING,
+					NULL, NULL, NULL)))
+		die("png_create_read_struct failed");
+
+	if (NULL == (pnginfo = png_create_info_struct(png)))
+		die("png_create_info_struct failed");
+
+	if (setjmp(png_jmpbuf(png)) != 0)
+		die("aborting due to libpng error");
+
+	png_init_io(png, fp);
+	png_read_info(png, pnginfo);
+
+	/* every pixel gets overwritten, but an opaque background
+	 * keeps opaque the border tiles of opaque images */
+	c = canvas_new(conn, win, png_get_image_width(png, pnginfo),
+			png_get_image_height(png, pnginfo), 0xff000000);
+
+	bit_depth = png_get_bit_depth(png, pnginfo);
+	passes = png_set_interlace_handling(png);
+
+	if (bit_depth == 16)
+		png_set_strip_16(png);
+
+	if (png_get_valid(png, pnginfo, PNG_INFO_tRNS))
+		png_set_tRNS_to_alpha(png);
+
+	switch (png_get_color_type(png, pnginfo)) {
+	case PNG_COLOR_TYPE_RGB:
+		png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+		break;
+	case PNG_COLOR_TYPE_PALETTE:
+		png_set_palette_to_rgb(png);
+		png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+		break;
+	case PNG_COLOR_TYPE_GRAY:
+		if (bit_depth < 8)
+			png_set_expand_gray_1_2_4_to_8(png);
+		png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+		png_set_gray_to_rgb(png);
+		break;
+	case PNG_COLOR_TYPE_GRAY_ALPHA:
+		png_set_gray_to_rgb(png);
+		break;
+	}
+
+	png_read_update_info(png, pnginfo);
+
+	/* read row by row straight into the tiles, interlaced
+	 * images refine the rows they already stored on each pass */
+	row = png_malloc(png, png_get_rowbytes(png, pnginfo));
+
+	for (pass = 0; pass < passes; ++pass) {
+		for (y = 0; y < c->height; ++y) {
+			if (pass > 0)
+				__canvas_fetch_row(c, y, row);
+			png_read_row(png, row, NULL);
+			__canvas_store_row(c, y, row);
+		}
+	}
+
+	__canvas_take_snapshot(c);
+	__canvas_damage_full(c);
+
+	png_free(png, row);
+	png_read_end(png, NULL);
+	png_free_data(png, pnginfo, PNG_FREE_ALL, -1);
+	png_destroy_info_struct(png, &pnginfo);
+	png_destroy_read_struct(&png, NULL, NULL);
+	fclose(fp);
+
+	return c;
+}
+
+extern void
+canvas_save(const Canvas *c, const char *path)
+{
+	int y;
 	FILE *fp;
 	png_struct *png;
 	png_info *pnginfo;
 	png_byte *row;
 
-	if (NULL == (fp = fopen(path, "wb")))
-		die("failed to open file %s:", path);
+	if (NULL == (fp = fopen(path, "wb")))
+		die("failed to open file %s:", path);
+
+	if (NULL == (png = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+					NULL, NULL, NULL)))
+		die("png_create_write_struct failed");
+
+	if (NULL == (pnginfo = png_create_info_struct(png)))
+		die("png_create_info_struct failed");
+
+	if (setjmp(png_jmpbuf(png)) != 0)
+		die("aborting due to libpng error");
+
+	png_init_io(png, fp);
+	png_set_IHDR(png, pnginfo, c->width, c->height, 8,
+		PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+		PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE
+	);
+
+	png_write_info(png, pnginfo);
+	png_set_compression_level(png, 3);
+
+	row = png_malloc(png, c->width * 4);
+
+	for (y = 0; y < c->height; ++y) {
+		__canvas_fetch_row(c, y, row);
+		png_write_row(png, row);
+	}
+
+	png_free(png, row);
+	png_write_end(png, NULL);
+	png_free_data(png, pnginfo, PNG_FREE_ALL, -1);
+	png_destroy_info_struct(png, &pnginfo);
+	png_destroy_write_struct(&png, NULL);
+	fclose(fp);
+}
+
+extern void
+canvas_move_relative(Canvas *c, int offx, int offy)
+{
+	c->pos.x += offx;
+	c->pos.y += offy;
+	c->invalid = 1;
+
+	__canvas_keep_visible(c);
+}
+
+extern void
+canvas_zoom(Canvas *c, int steps, int vx, int vy)
+{
+	int zoom;
+	float scale;
+
+	zoom = CLAMP(c->zoom + steps, ZOOM_MIN, ZOOM_MAX);
+
+	if (zoom == c->zoom)
+		return;
+
+	/* keep the canvas pixel under (vx, vy) in place */
+	scale = ldexpf(1.0f, zoom - c->zoom);
+	c->pos.x = vx - (vx - c->pos.x) * scale;
+	c->pos.y = vy - (vy - c->pos.y) * scale;
+	c->zoom = zoom;
+	c->invalid = 1;
+
+	__canvas_keep_visible(c);
+}
+
+extern float
+canvas_get_zoom(const Canvas *c)
+{
+	return ldexpf(1.0f, c->zoom);
+}
+
+extern void
+canvas_get_size(const Canvas *c, int *width, int *height)
+{
+	*width = c->width;
+	*height = c->height;
+}
+
+extern void
+canvas_set_viewport(Canvas *c, int vw, int vh)
+{
+	/* keep distance ratio from top/left/right/bottom */
+	c->pos.x += ((float)vw - c->viewport_width) / 2;
+	c->pos.y += ((float)vh - c->viewport_height) / 2;
+
+	c->viewport_width = vw;
+	c->viewport_height = vh;
+	c->invalid = 1;
+
+	__canvas_keep_visible(c);
+}
+
+/**
+ * Send a rectangle of the canvas (in display coordinates)
+ * to the window. Without shm the rows of the rectangle
+ * are packed first, as PutImage can't skip columns, and
+ * sent in bands no larger than XIMAGE_MAX_SIZE.
+*/
+static void
+__canvas_present(Canvas *c, Visual *v, const DamageRect *r)
+{
+	uint32_t *px;
+	int x, y, w, h, band, i;
+
+	x = r->x0 + v->ox;
+	y = r->y0 + v->oy;
+	w = r->x1 - r->x0;
+	h = r->y1 - r->y0;
+
+	if (c->shm) {
+		xcb_copy_area(c->conn, v->x.pixmap, c->win, c->gc, x, y, x, y, w, h);
+		return;
+	}
+
+	band = MAX(1, MIN(h, XIMAGE_MAX_SIZE / (w*4)));
+	px = w == v->width ? NULL : xmalloc(w*band*4);
+
+	for (; h > 0; y += band, h -= band) {
+		band = MIN(band, h);
+		if (NULL == px) {
+			xcb_put_image(c->conn, XCB_IMAGE_FORMAT_Z_PIXMAP, c->win, c->gc,
+					w, band, x, y, 0, c->depth, w*band*4,
+					(const uint8_t *)(&v->px[y*w]));
+			continue;
+		}
+		for (i = 0; i < band; ++i)
+			memcpy(&px[i*w], &v->px[(y+i)*v->width+x], w*4);
+		xcb_put_image(c->conn, XCB_IMAGE_FORMAT_Z_PIXMAP, c->win, c->gc,
+				w, band, x, y, 0, c->depth, w*band*4, (const uint8_t *)(px));
+	}
+
+	free(px);
+}
+
+static void
+__canvas_present_full(Canvas *c, Visual *v)
+{
+	DamageRect r;
+	int ox, oy, w, h;
+
+	__canvas_origin(c, &ox, &oy);
+	w = __canvas_display_size(c, c->width);
+	h = __canvas_display_size(c, c->height);
+
+	if (oy > 0)
+		xcb_clear_area(c->conn, 0, c->win, 0, 0, c->viewport_width, oy);
+
+	if (oy + h < c->viewport_height)
+		xcb_clear_area(c->conn, 0, c->win, 0, oy + h,
+				c->viewport_width, c->viewport_height - (oy + h));
+
+	if (ox > 0)
+		xcb_clear_area(c->conn, 0, c->win, 0, 0, ox, c->viewport_height);
+
+	if (ox + w < c->viewport_width)
+		xcb_clear_area(c->conn, 0, c->win, ox + w, 0,
+				c->viewport_width - (ox + w), c->viewport_height);
+
+	r = (DamageRect) { 0, 0, w, h };
+
+	if (__canvas_clip_to_viewport(c, &r))
+		__canvas_present(c, v, &r);
+}
+
+/**
+ * Hand the damage of the canvas over to every visual,
+ * as runs of consecutive dirty tiles of a row, and clean
+ * the tiles.
+*/
+static void
+__canvas_damage_visuals(Canvas *c)
+{
+	DamageRect *r, run;
+	int i, j, tx, ty, start;
+
+	for (i = 0; i < c->damage.nrects; ++i) {
+		r = &c->damage.rects[i];
+		for (ty = r->y0 >> TILE_SHIFT; ty <= (r->y1 - 1) >> TILE_SHIFT; ++ty) {
+			start = -1;
+			for (tx = r->x0 >> TILE_SHIFT; tx <= ((r->x1 - 1) >> TILE_SHIFT) + 1; ++tx) {
+				if (tx <= (r->x1 - 1) >> TILE_SHIFT &&
+						c->tiles[ty * c->tiles_w + tx].dirty) {
+					if (start < 0)
+						start = tx;
+					continue;
+				}
+
+				if (start < 0)
+					continue;
+
+				run.x0 = MAX(r->x0, start << TILE_SHIFT);
+				run.y0 = MAX(r->y0, ty << TILE_SHIFT);
+				run.x1 = MIN(r->x1, tx << TILE_SHIFT);
+				run.y1 = MIN(r->y1, (ty + 1) << TILE_SHIFT);
+				start = -1;
+
+				for (j = 0; j < c->nvisuals; ++j)
+					damage_add(&c->visuals[j].pending, run.x0, run.y0,
+							run.x1 - run.x0, run.y1 - run.y0);
+			}
+		}
+	}
+
+	for (i = 0; i < c->damage.nrects; ++i)
+		__canvas_clean(c, &c->damage.rects[i]);
+
+	damage_clear(&c->damage);
+}
+
+/**
+ * Bring the visual up to date: follow the size, zoom and
+ * position of the viewport, then composite the changes
+ * it hasn't shown yet.
+*/
+static void
+__canvas_visual_update(Canvas *c, Visual *v)
+{
+	DamageRect r;
+	int i;
 
-	if (NULL == (png = png_create_write_struct(PNG_LIBPNG_VER_STRING,
-					NULL, NULL, NULL)))
-		die("png_create_write_struct failed");
+	if (v->width != c->viewport_width || v->height != c->viewport_height) {
+		__canvas_visual_create(c, v);
+	} else if (v->stale || v->zoom != c->zoom) {
+		__canvas_visual_redraw(c, v);
+	} else {
+		__canvas_visual_scroll(c, v);
+	}
 
-	if (NULL == (pnginfo = png_create_info_struct(png)))
-		die("png_create_info_struct failed");
+	for (i = 0; i < v->pending.nrects; ++i) {
+		__canvas_rect_to_display(c, &v->pending.rects[i], &r);
+		if (__canvas_clip_to_viewport(c, &r))
+			__canvas_composite(c, v, &r);
+	}
+}
 
-	if (setjmp(png_jmpbuf(png)) != 0)
-		die("aborting due to libpng error");
+/**
+ * The visual the next frame is rendered into, one that
+ * the server is not using.
+*/
+static Visual *
+__canvas_back_visual(Canvas *c)
+{
+	int i;
 
-	png_init_io(png, fp);
-	png_set_IHDR(png, pnginfo, c->width, c->height, 8,
-		PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
-		PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE
-	);
+	for (i = 0; i < c->nvisuals; ++i)
+		if (!c->visuals[i].busy)
+			return &c->visuals[i];
 
-	png_write_info(png, pnginfo);
-	png_set_compression_level(png, 3);
+	return NULL;
+}
 
-	row = png_malloc(png, c->width * 4);
+extern void
+canvas_invalidate(Canvas *c)
+{
+	int i;
 
-	for (y = 0; y < c->height; ++y) {
-		for (x = 0; x < c->width; ++x)
-			color_unpack_to_arr(c->px_raw[y*c->width+x], &row[x*4]);
-		png_write_row(png, row);
+	c->invalid = 1;
+
+	/* overlays get drawn into the visuals themselves */
+	if (c->present.enabled)
+		for (i = 0; i < c->nvisuals; ++i)
+			c->visuals[i].stale = 1;
+}
+
+extern bool
+canvas_can_render(const Canvas *c)
+{
+	int i;
+
+	if (c->present.inflight)
+		return false;
+
+	for (i = 0; i < c->nvisuals; ++i)
+		if (!c->visuals[i].busy)
+			return true;
+
+	return false;
+}
+
+/**
+ * Set the update region of the frame to the changes the
+ * visual composited, unless all of it changed. The whole
+ * window is updated then, passing no region at all.
+*/
+static void
+__canvas_present_region(Canvas *c, Visual *v, int full)
+{
+	xcb_rectangle_t rects[DAMAGE_MAX_RECTS + 1];
+	DamageRect r;
+	int i, n;
+
+	c->present.full = full;
+
+	if (full)
+		return;
+
+	for (i = n = 0; i < v->pending.nrects; ++i) {
+		__canvas_rect_to_display(c, &v->pending.rects[i], &r);
+		if (!__canvas_clip_to_viewport(c, &r))
+			continue;
+		rects[n++] = (xcb_rectangle_t) {
+			r.x0 + v->ox, r.y0 + v->oy,
+			r.x1 - r.x0, r.y1 - r.y0
+		};
 	}
 
-	png_free(png, row);
-	png_write_end(png, NULL);
-	png_free_data(png, pnginfo, PNG_FREE_ALL, -1);
-	png_destroy_info_struct(png, &pnginfo);
-	png_destroy_write_struct(&png, NULL);
-	fclose(fp);
+	xcb_xfixes_set_region(c->conn, c->present.update, n, rects);
 }
 
-extern void
-canvas_move_relative(Canvas *c, int offx, int offy)
+extern xcb_drawable_t
+canvas_begin_frame(Canvas *c)
 {
-	c->pos.x += offx;
-	c->pos.y += offy;
+	DamageRect r;
+	Visual *v;
+	int i, ox, oy, full;
 
-	__canvas_keep_visible(c);
+	if (!canvas_can_render(c))
+		return XCB_NONE;
+
+	__canvas_damage_visuals(c);
+	v = c->back = __canvas_back_visual(c);
+
+	/* anything but compositing the damage redoes it all */
+	__canvas_origin(c, &ox, &oy);
+	full = c->invalid || v->stale || v->zoom != c->zoom ||
+		v->width != c->viewport_width || v->height != c->viewport_height ||
+		v->ox != ox || v->oy != oy;
+
+	__canvas_visual_update(c, v);
+
+	if (c->present.enabled) {
+		__canvas_present_region(c, v, full);
+		damage_clear(&v->pending);
+		return v->x.pixmap;
+	}
+
+	if (c->invalid) {
+		__canvas_present_full(c, v);
+		c->invalid = 0;
+	} else {
+		for (i = 0; i < v->pending.nrects; ++i) {
+			__canvas_rect_to_display(c, &v->pending.rects[i], &r);
+			if (__canvas_clip_to_viewport(c, &r))
+				__canvas_present(c, v, &r);
+		}
+	}
+
+	damage_clear(&v->pending);
+
+	return c->win;
 }
 
 extern void
-canvas_set_viewport(Canvas *c, int vw, int vh)
+canvas_end_frame(Canvas *c)
 {
-	/* keep distance ratio from top/left/right/bottom */
-	c->pos.x += ((float)vw - c->viewport_width) / 2;
-	c->pos.y += ((float)vh - c->viewport_height) / 2;
-
-	c->viewport_width = vw;
-	c->viewport_height = vh;
+	if (!c->present.enabled)
+		return;
 
-	__canvas_keep_visible(c);
+	/* shown on the vertical blank after the one the last
+	 * frame completed on (the next one if there was none),
+	 * the visual stays busy until the server tells us it's
+	 * idle again */
+	xcb_present_pixmap(c->conn, c->win, c->back->x.pixmap,
+			++c->present.serial, XCB_NONE,
+			c->present.full ? XCB_NONE : c->present.update, 0, 0,
+			XCB_NONE, XCB_NONE, XCB_NONE, XCB_PRESENT_OPTION_NONE,
+			c->present.msc != 0 ? c->present.msc + 1 : 0, 0, 0, 0, NULL);
+
+	c->back->busy = 1;
+	c->present.inflight = 1;
+	c->invalid = 0;
 }
 
 extern void
 canvas_render(Canvas *c)
 {
-	__canvas_damage_process(c);
+	if (XCB_NONE != canvas_begin_frame(c))
+		canvas_end_frame(c);
+}
 
-	if (c->pos.y > 0)
-		xcb_clear_area(c->conn, 0, c->win, 0, 0, c->viewport_width, c->pos.y);
+extern bool
+canvas_try_process_event(Canvas *c, const xcb_generic_event_t *ev)
+{
+	const xcb_ge_generic_event_t *ge;
+	const xcb_present_complete_notify_event_t *complete;
+	const xcb_present_idle_notify_event_t *idle;
+	int i;
 
-	if (c->pos.y + c->height < c->viewport_height)
-		xcb_clear_area(c->conn, 0, c->win, 0, c->pos.y + c->height,
-				c->viewport_width, c->viewport_height - (c->pos.y + c->height));
+	if (!c->present.enabled || (ev->response_type & ~0x80) != XCB_GE_GENERIC)
+		return false;
 
-	if (c->pos.x > 0)
-		xcb_clear_area(c->conn, 0, c->win, 0, 0, c->pos.x, c->viewport_height);
+	ge = (const xcb_ge_generic_event_t *)(ev);
 
-	if (c->pos.x + c->width < c->viewport_width)
-		xcb_clear_area(c->conn, 0, c->win, c->pos.x + c->width, 0,
-				c->viewport_width - (c->pos.x + c->width), c->viewport_height);
+	if (ge->extension != c->present.opcode)
+		return false;
 
-	if (c->shm) {
-		xcb_copy_area(c->conn, c->x.shm.pixmap, c->win,
-				c->gc, 0, 0, c->pos.x, c->pos.y, c->width, c->height);
-	} else {
-		xcb_image_put(c->conn, c->win, c->gc,
-				c->x.image, c->pos.x, c->pos.y, 0);
+	switch (ge->event_type) {
+	case XCB_PRESENT_COMPLETE_NOTIFY:
+		complete = (const xcb_present_complete_notify_event_t *)(ev);
+		if (complete->serial == c->present.serial)
+			c->present.inflight = 0;
+		c->present.msc = complete->msc;
+		break;
+	case XCB_PRESENT_IDLE_NOTIFY:
+		idle = (const xcb_present_idle_notify_event_t *)(ev);
+		for (i = 0; i < c->nvisuals; ++i)
+			if (c->visuals[i].x.pixmap == idle->pixmap)
+				c->visuals[i].busy = 0;
+		break;
 	}
 
-	xcb_flush(c->conn);
+	return true;
 }
 
 extern void
 canvas_set_pixel(Canvas *c, int x, int y, uint32_t color)
 {
+	Tile *t;
+
 	if (x >= 0 && x < c->width && y >= 0 && y < c->height) {
-		c->px_raw[y*c->width+x] = color;
-		__canvas_damage(c, x, y);
+		t = __canvas_tile(c, x, y);
+		*__tile_px_w(c, t, x, y) = color_premultiply(color);
+		t->data->opaque &= ALPHA(color) == 0xff;
+		__canvas_damage(c, x, y, 1, 1);
+	}
+}
+
+extern void
+canvas_fill_hspan(Canvas *c, int x0, int x1, int y, uint32_t color)
+{
+	uint32_t *px;
+	Tile *t;
+	int x, end;
+
+	if (y < 0 || y >= c->height)
+		return;
+
+	x0 = MAX(x0, 0);
+	x1 = MIN(x1, c->width - 1);
+
+	if (x0 > x1)
+		return;
+
+	color = color_premultiply(color);
+
+	for (x = x0; x <= x1; x = end) {
+		t = __canvas_tile(c, x, y);
+		end = MIN(x1 + 1, (x | TILE_MASK) + 1);
+		for (px = __tile_px_w(c, t, x, y); x < end; ++x)
+			*px++ = color;
+		t->data->opaque &= ALPHA(color) == 0xff;
+	}
+
+	__canvas_damage(c, x0, y, x1 - x0 + 1, 1);
+}
+
+extern void
+canvas_mix_hspan(Canvas *c, int x0, int x1, int y, uint32_t color,
+		const uint8_t *alpha)
+{
+	Tile *t;
+	int x, start, end;
+
+	if (y < 0 || y >= c->height)
+		return;
+
+	start = MAX(x0, 0);
+	x1 = MIN(x1, c->width - 1);
+
+	if (start > x1)
+		return;
+
+	color = color_premultiply(color);
+
+	for (x = start; x <= x1; x = end) {
+		t = __canvas_tile(c, x, y);
+		end = MIN(x1 + 1, (x | TILE_MASK) + 1);
+		blend_mix_color(__tile_px_w(c, t, x, y), color, &alpha[x - x0], end - x);
+		t->data->opaque &= ALPHA(color) == 0xff;
+	}
+
+	__canvas_damage(c, start, y, x1 - start + 1, 1);
+}
+
+/**
+ * Like canvas_mix_hspan, but mixing `color` into the pixels
+ * of `src` (premultiplied) rather than into the ones on the
+ * canvas, so that a span can be redone from what it was.
+*/
+extern void
+canvas_mix_hspan_from(Canvas *c, int x0, int x1, int y, uint32_t color,
+		const uint8_t *alpha, const uint32_t *src)
+{
+	Tile *t;
+	uint32_t *px;
+	int x, i, start, end, opaque;
+
+	if (y < 0 || y >= c->height)
+		return;
+
+	start = MAX(x0, 0);
+	x1 = MIN(x1, c->width - 1);
+
+	if (start > x1)
+		return;
+
+	color = color_premultiply(color);
+
+	for (x = start; x <= x1; x = end) {
+		t = __canvas_tile(c, x, y);
+		end = MIN(x1 + 1, (x | TILE_MASK) + 1);
+		px = __tile_px_w(c, t, x, y);
+		memcpy(px, &src[x - x0], (end - x) * sizeof(uint32_t));
+		blend_mix_color(px, color, &alpha[x - x0], end - x);
+		for (opaque = ALPHA(color) == 0xff, i = 0; opaque && i < end - x; ++i)
+			opaque = ALPHA(src[x - x0 + i]) == 0xff;
+		t->data->opaque &= opaque;
+	}
+
+	__canvas_damage(c, start, y, x1 - start + 1, 1);
+}
+
+extern void
+canvas_blend_hspan(Canvas *c, int x0, int x1, int y, uint32_t color,
+		uint8_t alpha)
+{
+	Tile *t;
+	int x, end;
+
+	if (y < 0 || y >= c->height)
+		return;
+
+	x0 = MAX(x0, 0);
+	x1 = MIN(x1, c->width - 1);
+
+	if (x0 > x1)
+		return;
+
+	color = color_premultiply(color);
+
+	for (x = x0; x <= x1; x = end) {
+		t = __canvas_tile(c, x, y);
+		end = MIN(x1 + 1, (x | TILE_MASK) + 1);
+		blend_mix_color_const(__tile_px_w(c, t, x, y), color, alpha, end - x);
+		t->data->opaque &= ALPHA(color) == 0xff;
+	}
+
+	__canvas_damage(c, x0, y, x1 - x0 + 1, 1);
+}
+
+/**
+ * Fill the rectangle with `color`. The tiles it covers
+ * whole end up sharing the same pixel data, only the
+ * ones on its border get written pixel by pixel.
+*/
+extern void
+canvas_fill_rect(Canvas *c, int x, int y, int w, int h, uint32_t color)
+{
+	TileData *solid;
+	uint32_t *px;
+	Tile *t;
+	int x0, y0, x1, y1, tx, ty, cx0, cy0, cx1, cy1, i, row;
+
+	x0 = MAX(x, 0);
+	y0 = MAX(y, 0);
+	x1 = MIN(x + w, c->width);
+	y1 = MIN(y + h, c->height);
+
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	color = color_premultiply(color);
+	solid = NULL;
+
+	for (ty = y0 >> TILE_SHIFT; ty <= (y1 - 1) >> TILE_SHIFT; ++ty) {
+		for (tx = x0 >> TILE_SHIFT; tx <= (x1 - 1) >> TILE_SHIFT; ++tx) {
+			t = &c->tiles[ty * c->tiles_w + tx];
+			cx0 = MAX(x0, tx << TILE_SHIFT);
+			cy0 = MAX(y0, ty << TILE_SHIFT);
+			cx1 = MIN(x1, (tx + 1) << TILE_SHIFT);
+			cy1 = MIN(y1, (ty + 1) << TILE_SHIFT);
+
+			if (cx0 == tx << TILE_SHIFT && cy0 == ty << TILE_SHIFT &&
+					cx1 == MIN(c->width, (tx + 1) << TILE_SHIFT) &&
+					cy1 == MIN(c->height, (ty + 1) << TILE_SHIFT)) {
+				if (NULL == solid) {
+					solid = __tile_data_new();
+					solid->opaque = ALPHA(color) == 0xff;
+					for (i = 0; i < TILE_PIXELS; ++i)
+						solid->px[i] = color;
+				}
+				__canvas_unref(c, t->data);
+				t->data = __tile_data_ref(solid);
+				t->gen++;
+				t->dirty = 1;
+				continue;
+			}
+
+			for (row = cy0; row < cy1; ++row)
+				for (px = __tile_px_w(c, t, cx0, row), i = cx0; i < cx1; ++i)
+					*px++ = color;
+			t->data->opaque &= ALPHA(color) == 0xff;
+		}
 	}
+
+	__tile_data_unref(solid);
+	__canvas_damage(c, x0, y0, x1 - x0, y1 - y0);
+}
+
+/**
+ * Read only pointer to the pixel (x, y), which stays valid
+ * along the row for the columns [*x0, *x1] sharing its tile,
+ * until the canvas gets written. Unlike canvas_get_pixel the
+ * pixels are premultiplied, as they are stored.
+*/
+extern const uint32_t *
+canvas_get_row(const Canvas *c, int x, int y, int *x0, int *x1)
+{
+	if (x < 0 || x >= c->width || y < 0 || y >= c->height)
+		return NULL;
+
+	*x0 = x & ~TILE_MASK;
+	*x1 = MIN(c->width, (x | TILE_MASK) + 1) - 1;
+
+	return __tile_px(__canvas_tile(c, x, y), x, y);
 }
 
 extern int
 canvas_get_pixel(Canvas *c, int x, int y, uint32_t *color)
 {
 	if (x >= 0 && x < c->width && y >= 0 && y < c->height) {
-		*color = c->px_raw[y*c->width+x];
+		*color = color_unpremultiply(*__tile_px(__canvas_tile(c, x, y), x, y));
 		return 1;
 	}
 	return 0;
@@ -455,8 +1826,17 @@ canvas_get_pixel(Canvas *c, int x, int y, uint32_t *color)
 extern void
 canvas_viewport_to_canvas_pos(Canvas *c, int x, int y, int *out_x, int *out_y)
 {
-	*out_x = x - c->pos.x;
-	*out_y = y - c->pos.y;
+	int ox, oy;
+
+	__canvas_origin(c, &ox, &oy);
+
+	if (c->zoom >= 0) {
+		*out_x = (x - ox) >> c->zoom;
+		*out_y = (y - oy) >> c->zoom;
+	} else {
+		*out_x = (x - ox) * (1 << -c->zoom);
+		*out_y = (y - oy) * (1 << -c->zoom);
+	}
 }
 
 extern void
@@ -465,21 +1845,254 @@ canvas_clear(Canvas *c)
 	__canvas_restore_snapshot(c);
 }
 
+static inline size_t
+__checkpoint_size(const CanvasCheckpoint *cp)
+{
+	return sizeof(CanvasCheckpoint) + cp->ntiles * sizeof(TileData *);
+}
+
+static inline size_t
+__delta_size(const CanvasDelta *d)
+{
+	return sizeof(CanvasDelta) + d->ntiles * sizeof(CanvasDeltaTile);
+}
+
+/**
+ * Taking a checkpoint only references the tile data, its
+ * pixels cost something only once the canvas moves on
+ * from them, see canvas_history_sweep.
+*/
+extern CanvasCheckpoint *
+canvas_checkpoint_new(Canvas *c)
+{
+	CanvasCheckpoint *cp;
+	int i;
+
+	cp = xmalloc(sizeof(CanvasCheckpoint));
+	cp->ntiles = c->tiles_w * c->tiles_h;
+	cp->data = xmalloc(cp->ntiles * sizeof(TileData *));
+	c->history.raw += __checkpoint_size(cp);
+	c->history.packed += __checkpoint_size(cp);
+
+	for (i = 0; i < cp->ntiles; ++i)
+		cp->data[i] = __tile_data_href(c->tiles[i].data);
+
+	return cp;
+}
+
+extern void
+canvas_checkpoint_restore(Canvas *c, const CanvasCheckpoint *cp)
+{
+	int tx, ty;
+
+	for (ty = 0; ty < c->tiles_h; ++ty)
+		for (tx = 0; tx < c->tiles_w; ++tx)
+			__canvas_restore_tile(c, tx, ty, cp->data[ty * c->tiles_w + tx]);
+}
+
+extern void
+canvas_checkpoint_free(Canvas *c, CanvasCheckpoint *cp)
+{
+	int i;
+
+	c->history.raw -= __checkpoint_size(cp);
+	c->history.packed -= __checkpoint_size(cp);
+
+	for (i = 0; i < cp->ntiles; ++i)
+		__canvas_hunref(c, cp->data[i]);
+
+	free(cp->data);
+	free(cp);
+}
+
+/**
+ * Make the checkpoint what the canvas is cleared to, in
+ * place of the snapshot, so the actions up to it can be
+ * forgotten.
+*/
+extern void
+canvas_checkpoint_fold(Canvas *c, const CanvasCheckpoint *cp)
+{
+	Tile *t;
+	int i;
+
+	for (i = 0; i < cp->ntiles; ++i) {
+		t = &c->tiles[i];
+		__canvas_unpack(c, cp->data[i]);
+		__canvas_unref(c, t->snapshot);
+		t->snapshot = __tile_data_ref(cp->data[i]);
+	}
+}
+
+/**
+ * Start tracking deltas from the pixels the canvas has
+ * now, dropping whatever changed since the last delta.
+*/
+extern void
+canvas_delta_reset(Canvas *c)
+{
+	Tile *t;
+	int i;
+
+	for (i = 0; i < c->tiles_w * c->tiles_h; ++i) {
+		t = &c->tiles[i];
+		if (t->base != t->data) {
+			__canvas_unref(c, t->base);
+			t->base = __tile_data_ref(t->data);
+		}
+	}
+}
+
+/**
+ * The tiles that changed since the last delta (or reset),
+ * NULL if none did. Copy on write already gave each of
+ * them new data, so finding them is a pointer compare per
+ * tile, and keeping them costs no copy.
+*/
+extern CanvasDelta *
+canvas_delta_take(Canvas *c)
+{
+	CanvasDelta *d;
+	Tile *t;
+	int i, n;
+
+	for (i = 0, n = 0; i < c->tiles_w * c->tiles_h; ++i)
+		n += NULL != c->tiles[i].base && c->tiles[i].base != c->tiles[i].data;
+
+	if (n == 0)
+		return NULL;
+
+	d = xmalloc(sizeof(CanvasDelta));
+	d->ntiles = n;
+	d->tiles = xmalloc(n * sizeof(CanvasDeltaTile));
+	c->history.raw += __delta_size(d);
+	c->history.packed += __delta_size(d);
+
+	for (i = 0, n = 0; i < c->tiles_w * c->tiles_h; ++i) {
+		t = &c->tiles[i];
+		if (NULL == t->base || t->base == t->data)
+			continue;
+		/* the reference of the base moves to the delta */
+		t->base->hrefs++;
+		__canvas_retain(c, t->base);
+		d->tiles[n++] = (CanvasDeltaTile) { i, t->base, __tile_data_href(t->data) };
+		t->base = __tile_data_ref(t->data);
+	}
+
+	return d;
+}
+
+static void
+__canvas_delta_apply(Canvas *c, const CanvasDelta *d, bool forward)
+{
+	TileData *data;
+	Tile *t;
+	int i, index;
+
+	for (i = 0; i < d->ntiles; ++i) {
+		index = d->tiles[i].index;
+		data = forward ? d->tiles[i].after : d->tiles[i].before;
+		t = &c->tiles[index];
+		__canvas_restore_tile(c, index % c->tiles_w, index / c->tiles_w, data);
+		__canvas_unref(c, t->base);
+		t->base = __tile_data_ref(data);
+	}
+}
+
+/**
+ * Put back the tiles of the delta as they were before
+ * it, the canvas has to be as it left them.
+*/
+extern void
+canvas_delta_undo(Canvas *c, const CanvasDelta *d)
+{
+	__canvas_delta_apply(c, d, false);
+}
+
+extern void
+canvas_delta_redo(Canvas *c, const CanvasDelta *d)
+{
+	__canvas_delta_apply(c, d, true);
+}
+
+extern void
+canvas_delta_free(Canvas *c, CanvasDelta *d)
+{
+	int i;
+
+	c->history.raw -= __delta_size(d);
+	c->history.packed -= __delta_size(d);
+
+	for (i = 0; i < d->ntiles; ++i) {
+		__canvas_hunref(c, d->tiles[i].before);
+		__canvas_hunref(c, d->tiles[i].after);
+	}
+
+	free(d->tiles);
+	free(d);
+}
+
+/**
+ * The history is charged for the tile data that only it
+ * still references, which is packed while nothing needs
+ * its pixels. Only the data the canvas let go of since
+ * the last sweep has to be looked at: what the history
+ * takes is kept up to date as checkpoints and deltas
+ * come and go, and as their data gets packed, freed or
+ * used by the canvas again.
+*/
+extern void
+canvas_history_sweep(Canvas *c)
+{
+	TileData *d;
+	int i;
+
+	for (i = 0; i < c->nretained; ++i) {
+		d = c->retained[i];
+		d->retained = 0;
+
+		/* only the history and the sweep hold it */
+		if (d->hrefs > 0 && d->refs == d->hrefs + 1 && NULL == d->packed) {
+			__tile_data_pack(d);
+			c->history.raw += TILE_PIXELS * sizeof(uint32_t);
+			c->history.packed += d->packed_size;
+		}
+
+		__tile_data_unref(d);
+	}
+
+	c->nretained = 0;
+}
+
+extern void
+canvas_get_history_stats(const Canvas *c, CanvasHistoryStats *stats)
+{
+	*stats = c->history;
+}
+
 extern void
 canvas_free(Canvas *c)
 {
+	int i;
+
 	xcb_free_gc(c->conn, c->gc);
 
-	if (c->shm) {
-		shmctl(c->x.shm.id, IPC_RMID, NULL);
-		xcb_shm_detach(c->conn, c->x.shm.seg);
-		shmdt(c->px_visual);
-		xcb_free_pixmap(c->conn, c->x.shm.pixmap);
-	} else {
-		xcb_image_destroy(c->x.image);
+	if (c->present.enabled)
+		xcb_xfixes_destroy_region(c->conn, c->present.update);
+
+	for (i = 0; i < c->nvisuals; ++i)
+		__canvas_visual_destroy(c, &c->visuals[i]);
+
+	for (i = 0; i < c->nretained; ++i)
+		__tile_data_unref(c->retained[i]);
+
+	for (i = 0; i < c->tiles_w * c->tiles_h; ++i) {
+		__tile_data_unref(c->tiles[i].data);
+		__tile_data_unref(c->tiles[i].snapshot);
+		__tile_data_unref(c->tiles[i].base);
 	}
 
-	free(c->px_raw);
-	free(c->px_snapshot);
+	free(c->retained);
+	free(c->tiles);
 	free(c);
 }
@@ -16,9 +16,29 @@
 
 */
 
+#include <math.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include "color.h"
+#include "utils.h"
+
+uint16_t color_to_linear[256 + 1];
+uint8_t color_from_linear[COLOR_LINEAR_INV_SIZE + 3];
+
+/* linear light interpolation by f = alpha / 255, which is
+ * exactly 1 for 255; the vectorized kernels do the same
+ * float operations in the same order */
+static inline uint8_t
+__linear_blend(uint8_t a, uint8_t b, float f)
+{
+	float la, lb;
+
+	la = color_to_linear[a];
+	lb = color_to_linear[b];
+
+	return color_from_linear[(int)(la + (lb - la) * f) >>
+			(COLOR_LINEAR_BITS - COLOR_LINEAR_INV_BITS)];
+}
 
 static inline uint8_t
 __alpha_blend(uint8_t a, uint8_t b, uint8_t alpha)
@@ -98,3 +118,132 @@ color_mix(uint32_t c1, uint32_t c2, uint8_t alpha)
 
 	return mixed;
 }
+
+/* premultiplied src over bg: src + bg * (255 - ALPHA(src)) / 255 */
+extern uint32_t
+color_over(uint32_t src, uint32_t bg)
+{
+	uint8_t s[4], b[4];
+	int i, k;
+
+	color_unpack_to_arr(src, s);
+	color_unpack_to_arr(bg, b);
+
+	for (k = 255 - s[3], i = 0; i < 4; ++i)
+		s[i] = MIN(255, s[i] + (b[i] * k) / 255);
+
+	return color_pack_from_arr(s);
+}
+
+extern void
+color_linear_init(void)
+{
+	double v, l;
+	int i;
+
+	for (i = 0; i < 256; ++i) {
+		v = i / 255.0;
+		l = v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+		color_to_linear[i] = lround(l * ((1 << COLOR_LINEAR_BITS) - 1));
+	}
+
+	for (i = 0; i < COLOR_LINEAR_INV_SIZE; ++i) {
+		l = (i + 0.5) / COLOR_LINEAR_INV_SIZE;
+		v = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1 / 2.4) - 0.055;
+		color_from_linear[i] = lround(v * 255);
+	}
+
+	/* the darkest codes are less than an entry apart
+	 * from their neighbours, make them round trip */
+	for (i = 0; i < 256; ++i)
+		color_from_linear[color_to_linear[i] >>
+				(COLOR_LINEAR_BITS - COLOR_LINEAR_INV_BITS)] = i;
+}
+
+/* the alpha channel isn't gamma encoded, it is interpolated
+ * with the same operations but without the tables */
+extern uint32_t
+color_mix_linear(uint32_t c1, uint32_t c2, uint8_t alpha)
+{
+	float f;
+
+	f = alpha * (1.0f / 255);
+
+	return __color_pack(
+		__linear_blend(RED(c1), RED(c2), f),
+		__linear_blend(GREEN(c1), GREEN(c2), f),
+		__linear_blend(BLUE(c1), BLUE(c2), f),
+		(int)(ALPHA(c1) + ((float)(ALPHA(c2)) - ALPHA(c1)) * f)
+	);
+}
+
+extern uint32_t
+color_over_linear(uint32_t src, uint32_t bg)
+{
+	uint8_t s[4], b[4];
+	float f;
+	int i, k;
+
+	color_unpack_to_arr(src, s);
+	color_unpack_to_arr(bg, b);
+
+	k = 255 - s[3];
+	f = k * (1.0f / 255);
+
+	for (i = 0; i < 3; ++i)
+		s[i] = color_from_linear[MIN(COLOR_LINEAR_INV_SIZE - 1,
+				(int)(color_to_linear[s[i]] + color_to_linear[b[i]] * f) >>
+				(COLOR_LINEAR_BITS - COLOR_LINEAR_INV_BITS))];
+
+	s[3] = MIN(255, s[3] + (b[3] * k) / 255);
+
+	return color_pack_from_arr(s);
+}
+
+extern uint32_t
+color_premultiply(uint32_t c)
+{
+	uint8_t a;
+
+	if ((a = ALPHA(c)) == 0xff)
+		return c;
+
+	return __color_pack(
+		(RED(c) * a + 127) / 255,
+		(GREEN(c) * a + 127) / 255,
+		(BLUE(c) * a + 127) / 255,
+		a
+	);
+}
+
+/* only defined for valid premultiplied colors, a color
+ * component can't be bigger than the alpha */
+extern uint32_t
+color_unpremultiply(uint32_t c)
+{
+	uint8_t a;
+
+	if ((a = ALPHA(c)) == 0xff)
+		return c;
+
+	if (a == 0)
+		return 0;
+
+	return __color_pack(
+		MIN(255, (RED(c) * 255 + a / 2) / a),
+		MIN(255, (GREEN(c) * 255 + a / 2) / a),
+		MIN(255, (BLUE(c) * 255 + a / 2) / a),
+		a
+	);
+}
+
+extern uint32_t
+color_average(uint32_t c1, uint32_t c2, uint32_t c3, uint32_t c4)
+{
+	return __color_pack(
+		(RED(c1) + RED(c2) + RED(c3) + RED(c4) + 2) / 4,
+		(GREEN(c1) + GREEN(c2) + GREEN(c3) + GREEN(c4) + 2) / 4,
+		(BLUE(c1) + BLUE(c2) + BLUE(c3) + BLUE(c4) + 2) / 4,
+		(ALPHA(c1) + ALPHA(c2) + ALPHA(c3) + ALPHA(c4) + 2) / 4
+	);
+}
@@ -0,0 +1,150 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "utils.h"
+#include "damage.h"
+
+static inline int64_t
+__rect_area(const DamageRect *r)
+{
+	return (int64_t)(r->x1 - r->x0) * (r->y1 - r->y0);
+}
+
+static inline DamageRect
+__rect_union(const DamageRect *a, const DamageRect *b)
+{
+	return (DamageRect) {
+		MIN(a->x0, b->x0), MIN(a->y0, b->y0),
+		MAX(a->x1, b->x1), MAX(a->y1, b->y1)
+	};
+}
+
+static inline bool
+__rect_contains(const DamageRect *a, const DamageRect *b)
+{
+	return b->x0 >= a->x0 && b->x1 <= a->x1 &&
+			b->y0 >= a->y0 && b->y1 <= a->y1;
+}
+
+static inline bool
+__rect_overlaps(const DamageRect *a, const DamageRect *b)
+{
+	return a->x0 < b->x1 && b->x0 < a->x1 &&
+			a->y0 < b->y1 && b->y0 < a->y1;
+}
+
+/**
+ * Area that would be covered by the union of both
+ * rectangles without being covered by any of them.
+*/
+static inline int64_t
+__rect_union_waste(const DamageRect *a, const DamageRect *b)
+{
+	DamageRect u;
+	u = __rect_union(a, b);
+	return __rect_area(&u) - __rect_area(a) - __rect_area(b);
+}
+
+static void
+__damage_remove(Damage *d, int i)
+{
+	d->rects[i] = d->rects[--d->nrects];
+}
+
+static void
+__damage_insert(Damage *d, DamageRect r)
+{
+	int i, j, bi, bj;
+	int64_t waste, best;
+
+	/* absorb every rectangle that overlaps the new one, or that is
+	 * cheap to join with it, until it doesn't grow any further */
+	for (i = 0; i < d->nrects; ++i) {
+		if (__rect_overlaps(&d->rects[i], &r) ||
+				__rect_union_waste(&d->rects[i], &r) <=
+				__rect_area(&d->rects[i]) + __rect_area(&r)) {
+			r = __rect_union(&d->rects[i], &r);
+			__damage_remove(d, i);
+			i = -1;
+		}
+	}
+
+	d->last = d->nrects;
+	d->rects[d->nrects++] = r;
+
+	if (d->nrects <= DAMAGE_MAX_RECTS)
+		return;
+
+	bi = 0; bj = 1;
+	best = __rect_union_waste(&d->rects[0], &d->rects[1]);
+
+	for (i = 0; i < d->nrects; ++i) {
+		for (j = i + 1; j < d->nrects; ++j) {
+			if ((waste = __rect_union_waste(&d->rects[i], &d->rects[j])) < best) {
+				best = waste;
+				bi = i; bj = j;
+			}
+		}
+	}
+
+	r = __rect_union(&d->rects[bi], &d->rects[bj]);
+	__damage_remove(d, bj);
+	__damage_remove(d, bi);
+	__damage_insert(d, r);
+}
+
+extern void
+damage_clear(Damage *d)
+{
+	d->nrects = 0;
+	d->last = 0;
+}
+
+extern bool
+damage_is_empty(const Damage *d)
+{
+	return d->nrects == 0;
+}
+
+extern void
+damage_add(Damage *d, int x, int y, int w, int h)
+{
+	DamageRect r;
+	int i;
+
+	if (w <= 0 || h <= 0)
+		return;
+
+	r = (DamageRect) { x, y, x + w, y + h };
+
+	/* consecutive pixels of a dab usually land in the same rectangle */
+	if (d->last < d->nrects && __rect_contains(&d->rects[d->last], &r))
+		return;
+
+	for (i = 0; i < d->nrects; ++i) {
+		if (__rect_contains(&d->rects[i], &r)) {
+			d->last = i;
+			return;
+		}
+	}
+
+	__damage_insert(d, r);
+}
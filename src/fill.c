@@ -0,0 +1,884 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "canvas.h"
+#include "color.h"
+#include "fill.h"
+#include "utils.h"
+
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define FILL_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifndef FILL_MAX_THREADS
+#define FILL_MAX_THREADS 16
+#endif
+
+/* filled pixels after which the rest of a fill gets labelled
+ * in parallel, if they also make 1/16 of the canvas */
+#define FILL_PARALLEL_MIN_PIXELS (1 << 20)
+#define FILL_STRIP_MIN_ROWS 64
+
+/* labelled runs are painted a block at a time, the
+ * blocks spanning a few tiles of the canvas so their
+ * rows stay close in memory; strips hold whole bands */
+#define FILL_PAINT_ROWS 64
+#define FILL_PAINT_COLS 512
+
+/* how long a step waits for the workers before giving
+ * the event loop its turn back */
+#define FILL_LABEL_WAIT_NS (4000000L)
+
+/**
+ * A maximal run [l, r] of target pixels of row y. Runs
+ * are found whole before being pushed, and nothing but
+ * filling the run itself can change its extent.
+*/
+typedef struct {
+	int l, r, y;
+} FillSpan;
+
+typedef struct FillStrip FillStrip;
+
+/**
+ * A fill grows its region from the runs of `stack` until
+ * it gets large, then the workers label the strips of the
+ * canvas while the fill waits for them, and the labelled
+ * components are painted a slice at a time.
+*/
+typedef enum {
+	FILL_SCAN,
+	FILL_LABEL,
+	FILL_PAINT
+} FillPhase;
+
+/**
+ * A fill in progress: the runs in `stack` are still to be
+ * painted. When `undoable`, the painted ones are kept in
+ * `done` so they can get their target color back.
+*/
+struct Fill {
+	Canvas *canvas;
+	uint32_t target, color;
+	int width, height;
+	/* one bit per pixel, set on the first pixel of
+	 * every run that has already been pushed; a row
+	 * gets its bits when its first run is pushed */
+	uint8_t **pushed;
+	FillSpan *stack;
+	size_t top, cap;
+	FillSpan *done;
+	size_t ndone, done_cap;
+	bool undoable;
+	size_t filled, parallel_min;
+	/* pixels of the whole region, known once labelled
+	 * and 0 until then */
+	size_t region;
+	int nthreads;
+	FillPhase phase;
+	/* while labelling: the strips handed to the pool,
+	 * how many of them it has yet to label (under the
+	 * lock of the pool), and whether they are wanted */
+	FillStrip *strips;
+	int nstrips, pending;
+	atomic_bool abort;
+	/* once labelled: the forest over the runs of every
+	 * strip, those of strip k numbered from offset[k]
+	 * on, the roots of the components to paint, the next
+	 * block to paint, in strip paint_k, and the next run
+	 * of each row of its band */
+	size_t *parent, *offset;
+	uint8_t *marked;
+	int paint_k, paint_x, paint_y;
+	size_t paint_run[FILL_PAINT_ROWS];
+};
+
+typedef struct {
+	int l, r;
+} FillRun;
+
+/**
+ * The rows [y0, y1) labelled by one worker: the runs of
+ * target pixels of every row, the ones of row y starting
+ * at runs[row[y - y0]], and a union-find forest over them
+ * (`parent` holds indices into `runs`) whose trees are the
+ * components of the strip.
+*/
+struct FillStrip {
+	Fill *f;
+	int y0, y1;
+	FillRun *runs;
+	size_t *parent, *row;
+	size_t nruns, cap;
+	FillStrip *next;
+};
+
+/**
+ * The workers that label strips, started the first time a
+ * fill needs them and kept for the next ones. They take
+ * the strips of `queue` when signalled `work`, and signal
+ * `done` after labelling each.
+*/
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+	FillStrip *queue;
+	int nworkers;
+} pool = {
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	NULL,
+	0
+};
+
+static int fill_threads;
+
+#ifdef FILL_SSE2
+/**
+ * Bit i is set when px[i] == target, for 16 pixels.
+*/
+static inline int
+__fill_eq_mask(const uint32_t *px, __m128i t)
+{
+	return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(
+				_mm_loadu_si128((const __m128i *)(&px[0])), t))) |
+		_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(
+				_mm_loadu_si128((const __m128i *)(&px[4])), t))) << 4 |
+		_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(
+				_mm_loadu_si128((const __m128i *)(&px[8])), t))) << 8 |
+		_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(
+				_mm_loadu_si128((const __m128i *)(&px[12])), t))) << 12;
+}
+#endif
+
+/**
+ * How many of the first `n` pixels are (when `eq`) or
+ * aren't (otherwise) `target`, 16 at a time.
+*/
+static int
+__fill_count(const uint32_t *px, int n, uint32_t target, bool eq)
+{
+	int i = 0;
+
+#ifdef FILL_SSE2
+	int m;
+
+	for (; i + 16 <= n; i += 16) {
+		m = __fill_eq_mask(&px[i], _mm_set1_epi32((int)(target)));
+		if (!eq)
+			m = ~m & 0xffff;
+		if (m != 0xffff)
+			return i + __builtin_ctz(~m);
+	}
+#endif
+
+	for (; i < n && (px[i] == target) == eq; ++i)
+		;
+
+	return i;
+}
+
+/**
+ * Same as __fill_count(..., true), but going to the left
+ * from px[-1] down to px[-n].
+*/
+static int
+__fill_count_left(const uint32_t *px, int n, uint32_t target)
+{
+	int i = 0;
+
+#ifdef FILL_SSE2
+	int m;
+
+	for (; i + 16 <= n; i += 16) {
+		m = __fill_eq_mask(&px[-i - 16], _mm_set1_epi32((int)(target)));
+		if (m != 0xffff)
+			return i + __builtin_clz(~m & 0xffff) - 16;
+	}
+#endif
+
+	for (; i < n && px[-i - 1] == target; ++i)
+		;
+
+	return i;
+}
+
+/**
+ * First column in [x, xmax] whose pixel is (when `eq`)
+ * or isn't (otherwise) the target, xmax + 1 if none.
+*/
+static int
+__fill_find(const Fill *f, int x, int xmax, int y, bool eq)
+{
+	const uint32_t *px;
+	int x0, x1, n;
+
+	while (x <= xmax && NULL != (px = canvas_get_row(f->canvas, x, y, &x0, &x1))) {
+		n = MIN(x1, xmax) - x + 1;
+		x += __fill_count(px, n, f->target, !eq);
+		if (x <= MIN(x1, xmax))
+			return x;
+	}
+
+	return xmax + 1;
+}
+
+/**
+ * Leftmost column of the run of target pixels that
+ * reaches x, which is part of it.
+*/
+static int
+__fill_run_left(const Fill *f, int x, int y)
+{
+	const uint32_t *px;
+	int x0, x1;
+
+	/* scan the pixels left of x one tile at a time, and
+	 * go on with the previous tile only if the run covers
+	 * the whole row of this one */
+	while (NULL != (px = canvas_get_row(f->canvas, x - 1, y, &x0, &x1))) {
+		x -= __fill_count_left(px + 1, x - x0, f->target);
+		if (x > x0)
+			break;
+	}
+
+	return x;
+}
+
+static void
+__fill_span(Fill *f, int l, int r, int y)
+{
+	canvas_fill_hspan(f->canvas, l, r, y, f->color);
+	f->filled += r - l + 1;
+
+	if (!f->undoable)
+		return;
+
+	if (f->ndone >= f->done_cap) {
+		f->done_cap = f->done_cap ? f->done_cap * 2 : 256;
+		f->done = xrealloc(f->done, f->done_cap * sizeof(FillSpan));
+	}
+
+	f->done[f->ndone++] = (FillSpan) { l, r, y };
+}
+
+static void
+__fill_push(Fill *f, int l, int r, int y)
+{
+	uint8_t *row;
+
+	if (NULL == (row = f->pushed[y]))
+		row = f->pushed[y] = xcalloc(((size_t)(f->width) + 7) / 8, 1);
+
+	if (row[l >> 3] & (1 << (l & 7)))
+		return;
+
+	row[l >> 3] |= 1 << (l & 7);
+
+	if (f->top >= f->cap) {
+		f->cap *= 2;
+		f->stack = xrealloc(f->stack, f->cap * sizeof(FillSpan));
+	}
+
+	f->stack[f->top++] = (FillSpan) { l, r, y };
+}
+
+/**
+ * Push the runs of target pixels of row y that touch
+ * the columns [l, r].
+*/
+static void
+__fill_push_runs(Fill *f, int l, int r, int y)
+{
+	int x, end;
+
+	if (y < 0 || y >= f->height)
+		return;
+
+	for (x = __fill_find(f, l, r, y, true); x <= r;
+			x = __fill_find(f, end + 1, r, y, true)) {
+		end = __fill_find(f, x, f->width - 1, y, false) - 1;
+		__fill_push(f, x == l ? __fill_run_left(f, x, y) : x, end, y);
+	}
+}
+
+static size_t
+__fill_find_root(size_t *parent, size_t i)
+{
+	while (parent[i] != i)
+		i = parent[i] = parent[parent[i]];
+	return i;
+}
+
+static void
+__fill_union(size_t *parent, size_t a, size_t b)
+{
+	a = __fill_find_root(parent, a);
+	b = __fill_find_root(parent, b);
+
+	/* the smaller index becomes the root, so the roots of a
+	 * strip are the first run of each of its components */
+	if (a < b)
+		parent[b] = a;
+	else
+		parent[a] = b;
+}
+
+/**
+ * Union the runs [a, a_end) of a row with the runs
+ * [b, b_end) of the next one that share a column.
+*/
+static void
+__fill_union_rows(const FillRun *runs, size_t *parent,
+		size_t a, size_t a_end, size_t b, size_t b_end)
+{
+	while (a < a_end && b < b_end) {
+		if (runs[a].l <= runs[b].r && runs[b].l <= runs[a].r)
+			__fill_union(parent, a, b);
+		if (runs[a].r < runs[b].r)
+			++a;
+		else
+			++b;
+	}
+}
+
+static void *
+__fill_strip_label(void *arg)
+{
+	FillStrip *st;
+	size_t i;
+	int x, end, y;
+
+	st = arg;
+
+	for (y = st->y0; y < st->y1; ++y) {
+		if (atomic_load_explicit(&st->f->abort, memory_order_relaxed))
+			return NULL;
+		st->row[y - st->y0] = st->nruns;
+		for (x = __fill_find(st->f, 0, st->f->width - 1, y, true);
+				x < st->f->width;
+				x = __fill_find(st->f, end + 1, st->f->width - 1, y, true)) {
+			end = __fill_find(st->f, x, st->f->width - 1, y, false) - 1;
+			if (st->nruns >= st->cap) {
+				st->cap *= 2;
+				st->runs = xrealloc(st->runs, st->cap * sizeof(FillRun));
+				st->parent = xrealloc(st->parent, st->cap * sizeof(size_t));
+			}
+			st->runs[st->nruns] = (FillRun) { x, end };
+			st->parent[st->nruns] = st->nruns;
+			st->nruns++;
+		}
+		if (y > st->y0)
+			__fill_union_rows(st->runs, st->parent,
+					st->row[y - st->y0 - 1], st->row[y - st->y0],
+					st->row[y - st->y0], st->nruns);
+	}
+
+	st->row[st->y1 - st->y0] = st->nruns;
+
+	/* flatten the forest, later finds stay one step long */
+	for (i = 0; i < st->nruns; ++i)
+		st->parent[i] = st->parent[st->parent[i]];
+
+	return NULL;
+}
+
+/**
+ * Index of the run of the strip starting at column l of
+ * row y, which must exist.
+*/
+static size_t
+__fill_strip_run_at(const FillStrip *st, int l, int y)
+{
+	size_t lo, hi, mid;
+
+	lo = st->row[y - st->y0];
+	hi = st->row[y - st->y0 + 1];
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (st->runs[mid].l <= l)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void *
+__fill_worker(void *arg)
+{
+	FillStrip *st;
+
+	(void) arg;
+
+	pthread_mutex_lock(&pool.lock);
+
+	for (;;) {
+		while (NULL == pool.queue)
+			pthread_cond_wait(&pool.work, &pool.lock);
+		st = pool.queue;
+		pool.queue = st->next;
+		pthread_mutex_unlock(&pool.lock);
+
+		__fill_strip_label(st);
+
+		pthread_mutex_lock(&pool.lock);
+		st->f->pending--;
+		pthread_cond_broadcast(&pool.done);
+	}
+
+	return NULL;
+}
+
+/**
+ * Start workers until there are `n`, returns how many
+ * there are.
+*/
+static int
+__fill_pool_reserve(int n)
+{
+	pthread_t thread;
+
+	pthread_mutex_lock(&pool.lock);
+
+	while (pool.nworkers < n && pthread_create(&thread, NULL,
+				__fill_worker, NULL) == 0) {
+		pthread_detach(thread);
+		pool.nworkers++;
+	}
+
+	n = pool.nworkers;
+	pthread_mutex_unlock(&pool.lock);
+
+	return n;
+}
+
+/**
+ * Hand the labelling of the connected runs of target pixels
+ * of the whole canvas over to the pool, a strip of rows per
+ * worker. The spans still in the stack are what is left of
+ * the region. False if there are no workers to take them.
+*/
+static bool
+__fill_label_start(Fill *f)
+{
+	FillStrip *st;
+	int k, nbands;
+
+	if (__fill_pool_reserve(f->nthreads) < 2) {
+		f->parallel_min = SIZE_MAX;
+		return false;
+	}
+
+	f->nstrips = MIN(f->nthreads, f->height / FILL_STRIP_MIN_ROWS);
+	f->strips = xmalloc(f->nstrips * sizeof(FillStrip));
+	nbands = (f->height + FILL_PAINT_ROWS - 1) / FILL_PAINT_ROWS;
+
+	for (k = 0; k < f->nstrips; ++k) {
+		st = &f->strips[k];
+		st->f = f;
+		st->y0 = nbands * k / f->nstrips * FILL_PAINT_ROWS;
+		st->y1 = k + 1 < f->nstrips ? nbands * (k + 1) / f->nstrips *
+				FILL_PAINT_ROWS : f->height;
+		st->cap = 256;
+		st->nruns = 0;
+		st->runs = xmalloc(st->cap * sizeof(FillRun));
+		st->parent = xmalloc(st->cap * sizeof(size_t));
+		st->row = xmalloc((st->y1 - st->y0 + 1) * sizeof(size_t));
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	for (k = f->nstrips - 1; k >= 0; --k) {
+		f->strips[k].next = pool.queue;
+		pool.queue = &f->strips[k];
+	}
+	f->pending = f->nstrips;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+
+	f->phase = FILL_LABEL;
+
+	return true;
+}
+
+/**
+ * Whether every strip is labelled, after waiting for them
+ * at most `ns` nanoseconds, or for as long as it takes if
+ * negative.
+*/
+static bool
+__fill_label_wait(Fill *f, long ns)
+{
+	struct timespec ts;
+	bool labelled;
+
+	pthread_mutex_lock(&pool.lock);
+
+	if (ns < 0) {
+		while (f->pending > 0)
+			pthread_cond_wait(&pool.done, &pool.lock);
+	} else if (f->pending > 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += ns;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+		pthread_cond_timedwait(&pool.done, &pool.lock, &ts);
+	}
+
+	labelled = f->pending == 0;
+	pthread_mutex_unlock(&pool.lock);
+
+	return labelled;
+}
+
+/**
+ * Merge the strips along their borders into one forest,
+ * flattened so every run points at its root, and mark the
+ * components holding one of the spans of the stack, which
+ * get painted. Their runs give the size of the region.
+*/
+static void
+__fill_merge(Fill *f)
+{
+	FillStrip *strips, *st;
+	size_t total, i, j;
+	int k, y;
+
+	strips = f->strips;
+
+	f->offset = xmalloc((f->nstrips + 1) * sizeof(size_t));
+	for (k = 0, total = 0; k < f->nstrips; total += strips[k++].nruns)
+		f->offset[k] = total;
+	f->offset[f->nstrips] = total;
+
+	f->parent = xmalloc(MAX(total, 1) * sizeof(size_t));
+	f->marked = xcalloc(MAX(total, 1), 1);
+
+	for (k = 0; k < f->nstrips; ++k)
+		for (i = 0; i < strips[k].nruns; ++i)
+			f->parent[f->offset[k] + i] = f->offset[k] + strips[k].parent[i];
+
+	for (k = 1; k < f->nstrips; ++k) {
+		st = &strips[k];
+		for (i = strips[k - 1].row[st->y0 - 1 - strips[k - 1].y0],
+				j = st->row[0];
+				i < strips[k - 1].nruns && j < st->row[1]; ) {
+			if (strips[k - 1].runs[i].l <= st->runs[j].r &&
+					st->runs[j].l <= strips[k - 1].runs[i].r)
+				__fill_union(f->parent, f->offset[k - 1] + i, f->offset[k] + j);
+			if (strips[k - 1].runs[i].r < st->runs[j].r)
+				++i;
+			else
+				++j;
+		}
+	}
+
+	/* a run never points past itself, so in index order
+	 * its parent already points at the root */
+	for (i = 0; i < total; ++i)
+		f->parent[i] = f->parent[f->parent[i]];
+
+	for (k = 0; f->top > 0; ) {
+		--f->top;
+		for (y = f->stack[f->top].y; y >= strips[k].y1 || y < strips[k].y0; )
+			k = (k + 1) % f->nstrips;
+		i = f->offset[k] + __fill_strip_run_at(&strips[k],
+				f->stack[f->top].l, y);
+		f->marked[f->parent[i]] = 1;
+	}
+
+	for (k = 0, f->region = f->filled; k < f->nstrips; ++k)
+		for (i = 0; i < strips[k].nruns; ++i)
+			if (f->marked[f->parent[f->offset[k] + i]])
+				f->region += strips[k].runs[i].r - strips[k].runs[i].l + 1;
+
+	f->paint_k = f->paint_x = f->paint_y = 0;
+	f->phase = FILL_PAINT;
+}
+
+/**
+ * Paint the runs of the marked components, a block of
+ * FILL_PAINT_ROWS by FILL_PAINT_COLS pixels after the
+ * other, until `end` pixels are filled. The pieces go
+ * through __fill_span like the spans of the scan, so a
+ * rollback takes them back too.
+*/
+static void
+__fill_paint(Fill *f, size_t end)
+{
+	const FillStrip *st;
+	const FillRun *run;
+	const size_t *parent;
+	size_t *i;
+	int x1, y, y1;
+
+	for (; f->paint_y < f->height; f->paint_y += FILL_PAINT_ROWS) {
+		while (f->paint_y >= f->strips[f->paint_k].y1)
+			f->paint_k++;
+		st = &f->strips[f->paint_k];
+		parent = &f->parent[f->offset[f->paint_k]];
+		y1 = MIN(f->height, f->paint_y + FILL_PAINT_ROWS);
+
+		if (f->paint_x == 0)
+			for (y = f->paint_y; y < y1; ++y)
+				f->paint_run[y - f->paint_y] = st->row[y - st->y0];
+
+		for (; f->paint_x < f->width; f->paint_x += FILL_PAINT_COLS) {
+			if (f->filled >= end)
+				return;
+			x1 = MIN(f->width, f->paint_x + FILL_PAINT_COLS) - 1;
+			for (y = f->paint_y; y < y1; ++y) {
+				/* a run crossing into the next block
+				 * stays the next one of its row */
+				for (i = &f->paint_run[y - f->paint_y];
+						*i < st->row[y - st->y0 + 1] &&
+						st->runs[*i].l <= x1; ++*i) {
+					run = &st->runs[*i];
+					if (f->marked[parent[*i]])
+						__fill_span(f, MAX(run->l, f->paint_x),
+								MIN(run->r, x1), y);
+					if (run->r > x1)
+						break;
+				}
+			}
+		}
+
+		f->paint_x = 0;
+	}
+}
+
+static bool
+__fill_done(const Fill *f)
+{
+	if (f->phase == FILL_PAINT)
+		return f->paint_y >= f->height;
+
+	return f->phase == FILL_SCAN && f->top == 0;
+}
+
+/**
+ * Set up a fill of the region of (x, y), false if there
+ * is nothing to paint.
+*/
+static bool
+__fill_init(Fill *f, Canvas *canvas, int x, int y, uint32_t color,
+		bool undoable)
+{
+	const uint32_t *px;
+	int x0, x1;
+
+	/* the rows hold premultiplied pixels, so compare
+	 * against the color the way it will be stored */
+	if (NULL == (px = canvas_get_row(canvas, x, y, &x0, &x1)))
+		return false;
+
+	f->canvas = canvas;
+	f->target = *px;
+	f->color = color;
+
+	if (f->target == color_premultiply(color))
+		return false;
+
+	canvas_get_size(canvas, &f->width, &f->height);
+	f->pushed = xcalloc(f->height, sizeof(uint8_t *));
+	f->cap = 256;
+	f->top = 0;
+	f->stack = xmalloc(f->cap * sizeof(FillSpan));
+	f->done = NULL;
+	f->ndone = f->done_cap = 0;
+	f->undoable = undoable;
+	f->filled = f->region = 0;
+	f->nthreads = MIN(FILL_MAX_THREADS, fill_threads > 0 ? fill_threads :
+			(int)(sysconf(_SC_NPROCESSORS_ONLN)));
+	f->parallel_min = f->nthreads > 1 && f->height >= 2 * FILL_STRIP_MIN_ROWS ?
+			MAX((size_t)(FILL_PARALLEL_MIN_PIXELS),
+					(size_t)(f->width) * f->height / 16) : SIZE_MAX;
+	f->phase = FILL_SCAN;
+	f->strips = NULL;
+	f->nstrips = 0;
+	atomic_init(&f->abort, false);
+	f->parent = f->offset = NULL;
+	f->marked = NULL;
+
+	__fill_push(f, __fill_run_left(f, x, y),
+			__fill_find(f, x, f->width - 1, y, false) - 1, y);
+
+	return true;
+}
+
+/**
+ * Stop the workers from labelling the strips of the fill,
+ * it won't paint them.
+*/
+static void
+__fill_label_abort(Fill *f)
+{
+	if (f->phase != FILL_LABEL)
+		return;
+
+	atomic_store(&f->abort, true);
+	__fill_label_wait(f, -1);
+	f->phase = FILL_SCAN;
+}
+
+static void
+__fill_release(Fill *f)
+{
+	int k, y;
+
+	__fill_label_abort(f);
+
+	for (k = 0; k < f->nstrips; ++k) {
+		free(f->strips[k].runs);
+		free(f->strips[k].parent);
+		free(f->strips[k].row);
+	}
+
+	free(f->strips);
+	free(f->parent);
+	free(f->offset);
+	free(f->marked);
+
+	for (y = 0; y < f->height; ++y)
+		free(f->pushed[y]);
+
+	free(f->pushed);
+	free(f->stack);
+	free(f->done);
+}
+
+extern Fill *
+fill_new(Canvas *canvas, int x, int y, uint32_t color)
+{
+	Fill *f;
+
+	f = xmalloc(sizeof(Fill));
+
+	if (!__fill_init(f, canvas, x, y, color, true)) {
+		free(f);
+		return NULL;
+	}
+
+	return f;
+}
+
+extern bool
+fill_step(Fill *f, size_t max_pixels)
+{
+	FillSpan s;
+	size_t end;
+
+	end = max_pixels > SIZE_MAX - f->filled ? SIZE_MAX : f->filled + max_pixels;
+
+	while (f->phase == FILL_SCAN && f->top > 0 && f->filled < end) {
+		/* the region is large, hand the rest over to the
+		 * workers */
+		if (f->filled >= f->parallel_min && __fill_label_start(f))
+			break;
+		s = f->stack[--f->top];
+		__fill_span(f, s.l, s.r, s.y);
+		__fill_push_runs(f, s.l, s.r, s.y - 1);
+		__fill_push_runs(f, s.l, s.r, s.y + 1);
+	}
+
+	/* a step asked to finish the fill waits for them */
+	if (f->phase == FILL_LABEL) {
+		if (!__fill_label_wait(f, max_pixels == SIZE_MAX ? -1 : FILL_LABEL_WAIT_NS))
+			return false;
+		__fill_merge(f);
+	}
+
+	if (f->phase == FILL_PAINT)
+		__fill_paint(f, end);
+
+	return __fill_done(f);
+}
+
+extern float
+fill_progress(const Fill *f)
+{
+	if (__fill_done(f))
+		return 1.0f;
+
+	/* the scan can't tell how much of the region it has
+	 * yet to reach, the spans of the stack only border it */
+	if (f->region == 0)
+		return -1.0f;
+
+	return MIN(1.0f, (float)(f->filled) / f->region);
+}
+
+extern void
+fill_rollback(Fill *f)
+{
+	uint32_t target;
+
+	/* premultiplying it again gives back the very same
+	 * stored value */
+	target = color_unpremultiply(f->target);
+
+	__fill_label_abort(f);
+
+	while (f->ndone > 0) {
+		--f->ndone;
+		canvas_fill_hspan(f->canvas, f->done[f->ndone].l,
+				f->done[f->ndone].r, f->done[f->ndone].y, target);
+	}
+
+	f->top = 0;
+	f->phase = FILL_SCAN;
+}
+
+extern void
+fill_free(Fill *f)
+{
+	__fill_release(f);
+	free(f);
+}
+
+extern void
+fill_flood(Canvas *canvas, int x, int y, uint32_t color)
+{
+	Fill f;
+
+	if (!__fill_init(&f, canvas, x, y, color, false))
+		return;
+
+	fill_step(&f, SIZE_MAX);
+	__fill_release(&f);
+}
+
+extern void
+fill_set_threads(int nthreads)
+{
+	fill_threads = nthreads;
+}
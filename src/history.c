@@ -24,12 +24,35 @@
 #include "history.h"
 
 static void
-__history_user_action_list_destroy(HistoryUserAction *list)
+__history_drop_checkpoint(History *hist, HistoryUserAction *hua)
+{
+	if (NULL == hua->checkpoint)
+		return;
+
+	hist->checkpoint_free(hua->checkpoint);
+	hua->checkpoint = NULL;
+}
+
+static void
+__history_drop_delta(History *hist, HistoryUserAction *hua)
+{
+	if (NULL == hua->delta)
+		return;
+
+	hist->delta_free(hua->delta);
+	hua->delta = NULL;
+}
+
+static void
+__history_user_action_list_destroy(History *hist, HistoryUserAction *list)
 {
 	HistoryUserAction *tmp;
 
 	while (NULL != list) {
 		tmp = list->next;
+		__history_drop_checkpoint(hist, list);
+		__history_drop_delta(hist, list);
+		hist->size -= history_action_size(list);
 		history_user_action_destroy(list);
 		list = tmp;
 	}
@@ -42,6 +65,10 @@ history_new(void)
 	hist = xmalloc(sizeof(History));
 	hist->root = history_user_action_new();
 	hist->current = hist->root;
+	hist->checkpoint_free = NULL;
+	hist->checkpoint_interval = 0;
+	hist->delta_free = NULL;
+	hist->size = history_action_size(hist->root);
 	return hist;
 }
 
@@ -75,8 +102,8 @@ history_user_action_push_point(HistoryUserAction *hua, int x, int y)
 extern void
 history_do(History *hist, HistoryUserAction *hua)
 {
-	// destroy redo history
-	__history_user_action_list_destroy(hist->current->next);
+	// destroy redo history, and its checkpoints
+	__history_user_action_list_destroy(hist, hist->current->next);
 
 	// link
 	hist->current->next = hua;
@@ -85,6 +112,7 @@ history_do(History *hist, HistoryUserAction *hua)
 
 	// update position in history
 	hist->current = hua;
+	hist->size += history_action_size(hua);
 }
 
 extern bool
@@ -105,6 +133,135 @@ history_redo(History *hist)
 	return true;
 }
 
+/*
+ * Checkpoints are disabled until the interval is set to a positive
+ * number of actions; `free_func` gets rid of the ones that are dropped.
+ */
+extern void
+history_set_checkpoints(History *hist, int interval,
+		HistoryCheckpointFreeFunc free_func)
+{
+	hist->checkpoint_interval = interval;
+	hist->checkpoint_free = free_func;
+}
+
+/*
+ * Whether the current action is `checkpoint_interval` actions past the
+ * last checkpoint (or the root).
+ */
+extern bool
+history_wants_checkpoint(const History *hist)
+{
+	const HistoryUserAction *hua;
+	int n;
+
+	if (hist->checkpoint_interval <= 0)
+		return false;
+
+	for (hua = hist->current, n = 0; hua != hist->root &&
+			NULL == hua->checkpoint; hua = hua->prev)
+		if (++n >= hist->checkpoint_interval)
+			return true;
+
+	return false;
+}
+
+extern void
+history_add_checkpoint(History *hist, HistoryUserAction *hua, void *checkpoint)
+{
+	__history_drop_checkpoint(hist, hua);
+	hua->checkpoint = checkpoint;
+}
+
+/*
+ * Closest action at or before `hua` that has a checkpoint, NULL if there
+ * is none and the canvas has to be rebuilt from the root.
+ */
+extern HistoryUserAction *
+history_last_checkpoint(const History *hist, HistoryUserAction *hua)
+{
+	for (; NULL != hua && hua != hist->root; hua = hua->prev)
+		if (NULL != hua->checkpoint)
+			return hua;
+
+	return NULL;
+}
+
+extern void
+history_set_deltas(History *hist, HistoryDeltaFreeFunc free_func)
+{
+	hist->delta_free = free_func;
+}
+
+extern void
+history_add_delta(History *hist, HistoryUserAction *hua, void *delta)
+{
+	__history_drop_delta(hist, hua);
+	hua->delta = delta;
+}
+
+/*
+ * An action that loses its delta (or never got one) is undone and redone
+ * by replaying, as without deltas. Those closest to the root go first,
+ * undos that far back are the least likely.
+ */
+extern bool
+history_drop_oldest_delta(History *hist)
+{
+	HistoryUserAction *hua;
+
+	for (hua = hist->root->next; NULL != hua; hua = hua->next) {
+		if (NULL != hua->delta) {
+			__history_drop_delta(hist, hua);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Forget the actions up to `hua`, whose result the caller made the new
+ * starting point of the canvas (what the root stands for). `hua` can't
+ * be past the current action.
+ */
+extern void
+history_fold(History *hist, HistoryUserAction *hua)
+{
+	HistoryUserAction *first;
+
+	if (hua == hist->root)
+		return;
+
+	if (hist->current == hua)
+		hist->current = hist->root;
+
+	first = hist->root->next;
+	hist->root->next = hua->next;
+	if (NULL != hua->next)
+		hua->next->prev = hist->root;
+
+	hua->next = NULL;
+	__history_user_action_list_destroy(hist, first);
+}
+
+/*
+ * Bytes taken by the description of the action, its checkpoint and delta
+ * aside.
+ */
+extern size_t
+history_action_size(const HistoryUserAction *hua)
+{
+	size_t size;
+
+	size = sizeof(HistoryUserAction);
+
+	if (hua->type == HISTORY_STROKE)
+		size += hua->stroke.cap_points * sizeof(HistoryPoint);
+
+	return size;
+}
+
 extern void
 history_user_action_destroy(HistoryUserAction *hua)
 {
@@ -117,6 +274,6 @@ history_user_action_destroy(HistoryUserAction *hua)
 extern void
 history_destroy(History *hist)
 {
-	__history_user_action_list_destroy(hist->root);
+	__history_user_action_list_destroy(hist, hist->root);
 	free(hist);
 }
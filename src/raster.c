@@ -0,0 +1,369 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "canvas.h"
+#include "history.h"
+#include "log.h"
+#include "raster.h"
+#include "stroke.h"
+#include "utils.h"
+
+#define RASTER_QUEUE_SIZE (1 << 12)
+#define RASTER_QUEUE_MASK (RASTER_QUEUE_SIZE - 1)
+/* how often a stroke reaches the canvas while the input keeps coming */
+#define RASTER_FLUSH_INTERVAL_NS (1000000000L / 60)
+
+typedef enum {
+	RASTER_STROKE_BEGIN,
+	RASTER_STROKE_POINT,
+	RASTER_STROKE_END,
+	RASTER_REPLAY,
+	RASTER_SYNC,
+	RASTER_QUIT
+} RasterCommandType;
+
+typedef struct {
+	RasterCommandType type;
+	union {
+		struct {
+			uint32_t color;
+			int size;
+			int x, y;
+		} stroke;
+		HistoryUserAction action;
+	};
+} RasterCommand;
+
+/**
+ * `head` is only written by the raster thread and `tail`
+ * by the input one, each command is counted in `pending`
+ * once it is in the queue so the raster thread can sleep
+ * while it is empty. `notified` is set while there is a
+ * byte in the pipe the input thread waits on.
+*/
+struct Raster {
+	Canvas *canvas;
+	RasterReplayFunc replay;
+	Stroke *stroke;
+	struct timespec last_flush;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	sem_t pending;
+	sem_t idle;
+	int fds[2];
+	atomic_bool notified;
+	atomic_size_t head;
+	atomic_size_t tail;
+	RasterCommand queue[RASTER_QUEUE_SIZE];
+};
+
+static void
+__raster_push(Raster *r, const RasterCommand *cmd)
+{
+	size_t tail;
+
+	tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	/* only when the raster thread is way behind */
+	while (tail - atomic_load_explicit(&r->head, memory_order_acquire) ==
+			RASTER_QUEUE_SIZE)
+		sched_yield();
+
+	r->queue[tail & RASTER_QUEUE_MASK] = *cmd;
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+	sem_post(&r->pending);
+}
+
+static void
+__raster_pop(Raster *r, RasterCommand *cmd)
+{
+	size_t head;
+
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	while (head == atomic_load_explicit(&r->tail, memory_order_acquire))
+		sched_yield();
+
+	*cmd = r->queue[head & RASTER_QUEUE_MASK];
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+static void
+__raster_wait(sem_t *sem)
+{
+	while (sem_wait(sem) != 0)
+		if (errno != EINTR)
+			die("sem_wait:");
+}
+
+/**
+ * Wake up the input thread, unless it has yet to take
+ * the previous notification.
+*/
+static void
+__raster_publish(Raster *r)
+{
+	if (!atomic_exchange(&r->notified, true))
+		if (write(r->fds[1], "", 1) != 1)
+			die("write:");
+}
+
+static void
+__raster_flush(Raster *r)
+{
+	if (NULL != r->stroke) {
+		pthread_mutex_lock(&r->lock);
+		stroke_flush(r->stroke);
+		pthread_mutex_unlock(&r->lock);
+	}
+
+	timespec_get(&r->last_flush, TIME_UTC);
+}
+
+static bool
+__raster_flush_due(const Raster *r)
+{
+	struct timespec now;
+
+	timespec_get(&now, TIME_UTC);
+
+	return (now.tv_sec - r->last_flush.tv_sec) * 1000000000L +
+		(now.tv_nsec - r->last_flush.tv_nsec) >= RASTER_FLUSH_INTERVAL_NS;
+}
+
+static void
+__raster_run(Raster *r, const RasterCommand *cmd)
+{
+	pthread_mutex_lock(&r->lock);
+
+	switch (cmd->type) {
+	case RASTER_STROKE_BEGIN:
+		if (NULL != r->stroke)
+			stroke_free(r->stroke);
+		r->stroke = stroke_new(r->canvas, cmd->stroke.color, cmd->stroke.size);
+		stroke_add_point(r->stroke, cmd->stroke.x, cmd->stroke.y);
+		break;
+	case RASTER_STROKE_POINT:
+		if (NULL != r->stroke)
+			stroke_add_point(r->stroke, cmd->stroke.x, cmd->stroke.y);
+		break;
+	case RASTER_STROKE_END:
+		if (NULL != r->stroke)
+			stroke_free(r->stroke);
+		r->stroke = NULL;
+		break;
+	case RASTER_REPLAY:
+		r->replay(&cmd->action);
+		break;
+	default:
+		break;
+	}
+
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void *
+__raster_main(void *arg)
+{
+	RasterCommand cmd;
+	Raster *r;
+	bool busy;
+
+	r = arg;
+	busy = false;
+
+	for (;;) {
+		/* the queue ran dry, show what was painted */
+		if (sem_trywait(&r->pending) != 0) {
+			if (busy) {
+				__raster_flush(r);
+				__raster_publish(r);
+				busy = false;
+			}
+			__raster_wait(&r->pending);
+		}
+
+		__raster_pop(r, &cmd);
+		busy = true;
+
+		switch (cmd.type) {
+		case RASTER_SYNC:
+			__raster_flush(r);
+			__raster_publish(r);
+			busy = false;
+			sem_post(&r->idle);
+			break;
+		case RASTER_QUIT:
+			__raster_run(r, &(RasterCommand) { .type = RASTER_STROKE_END });
+			return NULL;
+		default:
+			__raster_run(r, &cmd);
+			if (__raster_flush_due(r)) {
+				__raster_flush(r);
+				__raster_publish(r);
+			}
+			break;
+		}
+	}
+}
+
+extern Raster *
+raster_new(Canvas *canvas, RasterReplayFunc replay)
+{
+	Raster *r;
+
+	r = xcalloc(1, sizeof(Raster));
+	r->canvas = canvas;
+	r->replay = replay;
+	r->stroke = NULL;
+
+	atomic_init(&r->notified, false);
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	timespec_get(&r->last_flush, TIME_UTC);
+
+	if (pipe(r->fds) != 0)
+		die("pipe:");
+
+	fcntl(r->fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(r->fds[1], F_SETFD, FD_CLOEXEC);
+
+	if (sem_init(&r->pending, 0, 0) != 0 || sem_init(&r->idle, 0, 0) != 0)
+		die("sem_init:");
+
+	pthread_mutex_init(&r->lock, NULL);
+
+	if (pthread_create(&r->thread, NULL, __raster_main, r) != 0)
+		die("can't create the raster thread");
+
+	return r;
+}
+
+extern void
+raster_stroke_begin(Raster *r, uint32_t color, int size, int x, int y)
+{
+	__raster_push(r, &(RasterCommand) {
+		.type = RASTER_STROKE_BEGIN,
+		.stroke = { .color = color, .size = size, .x = x, .y = y }
+	});
+}
+
+extern void
+raster_stroke_point(Raster *r, int x, int y)
+{
+	__raster_push(r, &(RasterCommand) {
+		.type = RASTER_STROKE_POINT,
+		.stroke = { .x = x, .y = y }
+	});
+}
+
+extern void
+raster_stroke_end(Raster *r)
+{
+	__raster_push(r, &(RasterCommand) { .type = RASTER_STROKE_END });
+}
+
+extern void
+raster_replay(Raster *r, const HistoryUserAction *a)
+{
+	RasterCommand cmd;
+
+	if (a->type == HISTORY_STROKE)
+		die("raster_replay: strokes go through raster_stroke_*");
+
+	cmd.type = RASTER_REPLAY;
+	cmd.action = *a;
+	cmd.action.prev = cmd.action.next = NULL;
+
+	__raster_push(r, &cmd);
+}
+
+extern void
+raster_sync(Raster *r)
+{
+	__raster_push(r, &(RasterCommand) { .type = RASTER_SYNC });
+	__raster_wait(&r->idle);
+}
+
+extern void
+raster_lock(Raster *r)
+{
+	pthread_mutex_lock(&r->lock);
+}
+
+extern bool
+raster_trylock(Raster *r)
+{
+	return pthread_mutex_trylock(&r->lock) == 0;
+}
+
+extern void
+raster_unlock(Raster *r)
+{
+	pthread_mutex_unlock(&r->lock);
+}
+
+extern int
+raster_get_fd(const Raster *r)
+{
+	return r->fds[0];
+}
+
+/**
+ * Take the notification of the raster thread, once the
+ * fd is readable. Returns whether there was one.
+*/
+extern bool
+raster_take_damage(Raster *r)
+{
+	char c;
+
+	if (read(r->fds[0], &c, 1) != 1)
+		return false;
+
+	atomic_store(&r->notified, false);
+
+	return true;
+}
+
+extern void
+raster_free(Raster *r)
+{
+	__raster_push(r, &(RasterCommand) { .type = RASTER_QUIT });
+	pthread_join(r->thread, NULL);
+	pthread_mutex_destroy(&r->lock);
+	sem_destroy(&r->pending);
+	sem_destroy(&r->idle);
+	close(r->fds[0]);
+	close(r->fds[1]);
+	free(r);
+}
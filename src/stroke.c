@@ -0,0 +1,495 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "brush.h"
+#include "canvas.h"
+#include "stroke.h"
+#include "utils.h"
+
+#define STROKE_COV_SHIFT (6)
+#define STROKE_COV_SIZE (1 << STROKE_COV_SHIFT)
+#define STROKE_COV_MASK (STROKE_COV_SIZE - 1)
+#define STROKE_COV_PIXELS (STROKE_COV_SIZE * STROKE_COV_SIZE)
+#define STROKE_DAB_SPACING_FACTOR 0.55f
+
+typedef struct {
+	/* per pixel, the lowest `keep` factor the segments gave it,
+	 * the one already mixed into the canvas (0xff: none yet)
+	 * and the pixel from before the stroke, saved when first
+	 * mixed, which every later mix starts again from */
+	uint8_t cov[STROKE_COV_PIXELS];
+	uint8_t done[STROKE_COV_PIXELS];
+	uint32_t src[STROKE_COV_PIXELS];
+} StrokeBlock;
+
+struct Stroke {
+	Canvas *canvas;
+	uint32_t color;
+	int size;
+	int npoints;
+	int last_x, last_y;
+	int width, height;
+	/* lazily allocated blocks of coverage (NULL: untouched),
+	 * over a grid of cov_w x cov_h blocks from (ox, oy) which
+	 * grows to hold the bounding box of the stroke so far */
+	int ox, oy;
+	int cov_w, cov_h;
+	StrokeBlock **cov;
+	/* columns changed since the last flush, per row of the grid */
+	int dirty;
+	int dy0, dy1;
+	int *dx0, *dx1;
+	uint8_t *row;
+	uint32_t *src;
+	/* squared distance from which a pixel keeps at least `i` */
+	float min_d2[256];
+};
+
+#ifdef APINT_USE_DAB_STROKES
+static void
+__stroke_dab(Canvas *canvas, int x, int y, uint32_t color, int size)
+{
+	const BrushStamp *stamp;
+	int dy, x0, x1;
+
+	stamp = brush_stamp_get(size);
+
+	for (dy = -size; dy < size; ++dy) {
+		x0 = stamp->x0[dy + size];
+		x1 = stamp->x1[dy + size];
+		if (x0 > x1)
+			continue;
+#ifdef APINT_USE_ROUGH_BRUSH
+		canvas_fill_hspan(canvas, x + x0, x + x1, y + dy, color);
+#else
+		canvas_mix_hspan(canvas, x + x0, x + x1, y + dy, color,
+				&stamp->alpha[(dy + size) * 2 * size + x0 + size]);
+#endif
+	}
+}
+
+/*
+ * The old way of drawing a segment: full dabs, a fraction of the
+ * brush size apart. Pixels get mixed once per dab covering them.
+ */
+static void
+__stroke_dab_segment(Stroke *s, int x0, int y0, int x1, int y1)
+{
+	int i, steps, dx, dy;
+	float dist, spacing, stepx, stepy;
+
+	dx = x1 - x0;
+	dy = y1 - y0;
+	dist = sqrtf((float)(dx*dx + dy*dy));
+
+	if (dist <= 0.0f)
+		return;
+
+	spacing = MAX(1.0f, s->size * STROKE_DAB_SPACING_FACTOR);
+	steps = (int)ceilf(dist / spacing);
+	stepx = dx / (float)steps;
+	stepy = dy / (float)steps;
+
+	for (i = 1; i <= steps; ++i)
+		__stroke_dab(s->canvas, (int)lroundf(x0 + stepx * i),
+				(int)lroundf(y0 + stepy * i), s->color, s->size);
+}
+#else
+static StrokeBlock **
+__stroke_block_at(Stroke *s, int x, int y)
+{
+	return &s->cov[((y - s->oy) >> STROKE_COV_SHIFT) * s->cov_w +
+			((x - s->ox) >> STROKE_COV_SHIFT)];
+}
+
+static StrokeBlock *
+__stroke_block(Stroke *s, int x, int y)
+{
+	StrokeBlock **block;
+
+	block = __stroke_block_at(s, x, y);
+
+	if (NULL == *block) {
+		*block = xmalloc(sizeof(StrokeBlock));
+		memset((*block)->cov, 0xff, STROKE_COV_PIXELS);
+		memset((*block)->done, 0xff, STROKE_COV_PIXELS);
+	}
+
+	return *block;
+}
+
+/**
+ * Make the grid of blocks hold the pixels from (x0, y0) to
+ * (x1, y1). It grows at least twice as large on each side it
+ * has to, so that a long stroke only reallocates it a few
+ * times.
+*/
+static void
+__stroke_grow(Stroke *s, int x0, int y0, int x1, int y1)
+{
+	StrokeBlock **cov;
+	int *dx0, *dx1;
+	int bx0, by0, bx1, by1, gx0, gy0, gx1, gy1, w, h, i, j;
+
+	bx0 = x0 >> STROKE_COV_SHIFT;
+	by0 = y0 >> STROKE_COV_SHIFT;
+	bx1 = x1 >> STROKE_COV_SHIFT;
+	by1 = y1 >> STROKE_COV_SHIFT;
+
+	if (NULL != s->cov) {
+		gx0 = s->ox >> STROKE_COV_SHIFT;
+		gy0 = s->oy >> STROKE_COV_SHIFT;
+		gx1 = gx0 + s->cov_w - 1;
+		gy1 = gy0 + s->cov_h - 1;
+
+		if (bx0 >= gx0 && by0 >= gy0 && bx1 <= gx1 && by1 <= gy1)
+			return;
+
+		bx0 = bx0 < gx0 ? MAX(0, MIN(bx0, gx0 - s->cov_w)) : gx0;
+		by0 = by0 < gy0 ? MAX(0, MIN(by0, gy0 - s->cov_h)) : gy0;
+		bx1 = bx1 > gx1 ? MIN((s->width - 1) >> STROKE_COV_SHIFT, MAX(bx1, gx1 + s->cov_w)) : gx1;
+		by1 = by1 > gy1 ? MIN((s->height - 1) >> STROKE_COV_SHIFT, MAX(by1, gy1 + s->cov_h)) : gy1;
+	}
+
+	w = bx1 - bx0 + 1;
+	h = by1 - by0 + 1;
+	cov = xcalloc(w * h, sizeof(StrokeBlock *));
+	dx0 = xmalloc((h << STROKE_COV_SHIFT) * sizeof(int));
+	dx1 = xmalloc((h << STROKE_COV_SHIFT) * sizeof(int));
+
+	for (i = 0; i < h << STROKE_COV_SHIFT; ++i) {
+		dx0[i] = s->width;
+		dx1[i] = -1;
+	}
+
+	if (NULL != s->cov) {
+		gx0 = (s->ox >> STROKE_COV_SHIFT) - bx0;
+		gy0 = (s->oy >> STROKE_COV_SHIFT) - by0;
+
+		for (j = 0; j < s->cov_h; ++j)
+			for (i = 0; i < s->cov_w; ++i)
+				cov[(gy0 + j) * w + gx0 + i] = s->cov[j * s->cov_w + i];
+
+		memcpy(&dx0[gy0 << STROKE_COV_SHIFT], s->dx0, (s->cov_h << STROKE_COV_SHIFT) * sizeof(int));
+		memcpy(&dx1[gy0 << STROKE_COV_SHIFT], s->dx1, (s->cov_h << STROKE_COV_SHIFT) * sizeof(int));
+
+		free(s->cov);
+		free(s->dx0);
+		free(s->dx1);
+	}
+
+	s->ox = bx0 << STROKE_COV_SHIFT;
+	s->oy = by0 << STROKE_COV_SHIFT;
+	s->cov_w = w;
+	s->cov_h = h;
+	s->cov = cov;
+	s->dx0 = dx0;
+	s->dx1 = dx1;
+	s->row = xrealloc(s->row, w << STROKE_COV_SHIFT);
+	s->src = xrealloc(s->src, (w << STROKE_COV_SHIFT) * sizeof(uint32_t));
+}
+
+/**
+ * Lower the coverage map to the capsule of radius `size`
+ * around the segment (x0, y0)-(x1, y1). A pixel at distance
+ * d keeps d/size of its color (like a dab does), unless an
+ * earlier segment of the stroke already covered it more.
+ * When the segment continues the stroke, everything behind
+ * (x0, y0) is as close to the previous segment as to this
+ * one, so only the half plane in front of it is scanned.
+*/
+static void
+__stroke_segment(Stroke *s, int x0, int y0, int x1, int y1, bool cont)
+{
+	double dx, dy, inv_dx, inv_dy, len, xa, xb, across, inv_len2;
+	float d2, scale;
+	int64_t along, len2;
+	int r, bx0, by0, bx1, by1, x, y, lo, hi, end, first, last;
+	uint8_t keep, prev, *cov;
+	const float *min_d2 = s->min_d2;
+
+	r = s->size;
+	dx = x1 - x0;
+	dy = y1 - y0;
+	len2 = (int64_t)(x1 - x0) * (x1 - x0) + (int64_t)(y1 - y0) * (y1 - y0);
+	len = sqrt(len2);
+	inv_len2 = len2 > 0 ? 1.0 / len2 : 0.0;
+	inv_dx = x1 != x0 ? 1.0 / dx : 0.0;
+	inv_dy = y1 != y0 ? 1.0 / dy : 0.0;
+#ifdef APINT_USE_ROUGH_BRUSH
+	scale = 0.0f;
+#else
+	scale = 255.0f / r;
+#endif
+
+	if (cont && len2 == 0)
+		return;
+
+	bx0 = MAX(0, MIN(x0, x1) - r + 1);
+	by0 = MAX(0, MIN(y0, y1) - r + 1);
+	bx1 = MIN(s->width - 1, MAX(x0, x1) + r - 1);
+	by1 = MIN(s->height - 1, MAX(y0, y1) + r - 1);
+
+	if (bx0 > bx1 || by0 > by1)
+		return;
+
+	__stroke_grow(s, bx0, by0, bx1, by1);
+
+	for (y = by0; y <= by1; ++y) {
+		lo = bx0;
+		hi = bx1;
+
+		/* columns within `r` of the line through the segment */
+		if (y1 != y0) {
+			xa = x0 + ((y - y0) * dx - r * len) * inv_dy;
+			xb = x0 + ((y - y0) * dx + r * len) * inv_dy;
+			lo = MAX(lo, (int)(MIN(xa, xb)) - 1);
+			hi = MIN(hi, (int)(MAX(xa, xb)) + 1);
+		}
+
+		/* columns in front of (x0, y0) */
+		if (cont) {
+			if (x1 > x0)
+				lo = MAX(lo, (int)(x0 - (y - y0) * dy * inv_dx) - 1);
+			else if (x1 < x0)
+				hi = MIN(hi, (int)(x0 - (y - y0) * dy * inv_dx) + 1);
+			else if ((y - y0) * dy <= 0)
+				continue;
+		}
+
+		/* position along and across the segment, scaled by its length */
+		along = (int64_t)(lo - x0) * (x1 - x0) + (int64_t)(y - y0) * (y1 - y0);
+		across = (double)(lo - x0) * (y1 - y0) - (double)(y - y0) * (x1 - x0);
+
+		first = last = -1;
+
+		for (x = lo; x <= hi; x = end + 1) {
+			end = MIN(hi, x | STROKE_COV_MASK);
+			cov = &__stroke_block(s, x, y)->cov[(y & STROKE_COV_MASK) << STROKE_COV_SHIFT];
+
+			for (; x <= end; ++x, along += x1 - x0, across += dy) {
+				if (along <= 0)
+					d2 = (float)(x - x0) * (x - x0) + (float)(y - y0) * (y - y0);
+				else if (along >= len2)
+					d2 = (float)(x - x1) * (x - x1) + (float)(y - y1) * (y - y1);
+				else
+					d2 = across * across * inv_len2;
+
+				/* cheap rejection of the pixels which are
+				 * already covered at least this much */
+				prev = cov[x & STROKE_COV_MASK];
+				if (d2 >= min_d2[prev])
+					continue;
+
+				keep = sqrtf(d2) * scale;
+				if (keep < prev) {
+					cov[x & STROKE_COV_MASK] = keep;
+					if (first < 0)
+						first = x;
+					last = x;
+				}
+			}
+		}
+
+		if (first < 0)
+			continue;
+
+		s->dx0[y - s->oy] = MIN(s->dx0[y - s->oy], first);
+		s->dx1[y - s->oy] = MAX(s->dx1[y - s->oy], last);
+
+		if (!s->dirty) {
+			s->dy0 = s->dy1 = y;
+			s->dirty = 1;
+		} else {
+			s->dy0 = MIN(s->dy0, y);
+			s->dy1 = MAX(s->dy1, y);
+		}
+	}
+}
+
+static void
+__stroke_read_row(Stroke *s, int first, int last, int y)
+{
+	const uint32_t *px;
+	int x, x0, x1;
+
+	for (x = first; x <= last; x = x1 + 1) {
+		px = canvas_get_row(s->canvas, x, y, &x0, &x1);
+		x1 = MIN(x1, last);
+		memcpy(&s->src[x - s->ox], px, (x1 - x + 1) * sizeof(uint32_t));
+	}
+}
+
+static void
+__stroke_mix_runs(Stroke *s, int first, int last, int y)
+{
+	int x, end, gap;
+
+	/* split the row where the coverage didn't change for a
+	 * while, mixing with 0xff would be a no-op anyway */
+	while (first <= last) {
+		for (end = first, gap = 0, x = first; x <= last && gap < STROKE_COV_SIZE / 2; ++x) {
+			if (s->row[x - s->ox] == 0xff) {
+				++gap;
+			} else {
+				end = x;
+				gap = 0;
+			}
+		}
+
+		canvas_mix_hspan_from(s->canvas, first, end, y, s->color,
+				&s->row[first - s->ox], &s->src[first - s->ox]);
+
+		for (first = end + 1; first <= last && s->row[first - s->ox] == 0xff; ++first)
+			;
+	}
+}
+#endif
+
+extern Stroke *
+stroke_new(Canvas *canvas, uint32_t color, int size)
+{
+	Stroke *s;
+	int i;
+
+	s = xcalloc(1, sizeof(Stroke));
+	s->canvas = canvas;
+	s->color = color;
+	s->size = size;
+
+	canvas_get_size(canvas, &s->width, &s->height);
+
+	for (i = 0; i < 256; ++i) {
+#ifdef APINT_USE_ROUGH_BRUSH
+		s->min_d2[i] = i == 0 ? 0 : (float)(size) * size;
+#else
+		s->min_d2[i] = (i * (float)(size) / 0xff) * (i * (float)(size) / 0xff);
+#endif
+	}
+
+	return s;
+}
+
+extern void
+stroke_add_point(Stroke *s, int x, int y)
+{
+#ifdef APINT_USE_DAB_STROKES
+	if (s->npoints == 0)
+		__stroke_dab(s->canvas, x, y, s->color, s->size);
+	else
+		__stroke_dab_segment(s, s->last_x, s->last_y, x, y);
+#else
+	if (s->npoints == 0)
+		__stroke_segment(s, x, y, x, y, false);
+	else
+		__stroke_segment(s, s->last_x, s->last_y, x, y, true);
+#endif
+
+	s->last_x = x;
+	s->last_y = y;
+	s->npoints++;
+}
+
+extern void
+stroke_flush(Stroke *s)
+{
+#ifndef APINT_USE_DAB_STROKES
+	int x, y, i, x0, x1, end;
+	StrokeBlock *block;
+	uint8_t *cov, *done;
+	uint32_t *src;
+
+	if (!s->dirty)
+		return;
+
+	for (y = s->dy0; y <= s->dy1; ++y) {
+		x0 = s->dx0[y - s->oy];
+		x1 = s->dx1[y - s->oy];
+
+		if (x0 > x1)
+			continue;
+
+		__stroke_read_row(s, x0, x1, y);
+
+		for (x = x0; x <= x1; x = end + 1) {
+			end = MIN(x1, x | STROKE_COV_MASK);
+			block = *__stroke_block_at(s, x, y);
+
+			if (NULL == block) {
+				memset(&s->row[x - s->ox], 0xff, end - x + 1);
+				continue;
+			}
+
+			i = (y & STROKE_COV_MASK) << STROKE_COV_SHIFT;
+			cov = &block->cov[i];
+			done = &block->done[i];
+			src = &block->src[i];
+
+			for (; x <= end; ++x) {
+				i = x & STROKE_COV_MASK;
+				s->row[x - s->ox] = 0xff;
+
+				if (cov[i] == done[i])
+					continue;
+
+				/* mix the whole coverage into the pixel from
+				 * before the stroke, so the result is the same
+				 * however many flushes it took to get there */
+				if (done[i] == 0xff)
+					src[i] = s->src[x - s->ox];
+
+				s->row[x - s->ox] = done[i] = cov[i];
+				s->src[x - s->ox] = src[i];
+			}
+		}
+
+		__stroke_mix_runs(s, x0, x1, y);
+
+		s->dx0[y - s->oy] = s->width;
+		s->dx1[y - s->oy] = -1;
+	}
+
+	s->dirty = 0;
+#else
+	(void) s;
+#endif
+}
+
+extern void
+stroke_free(Stroke *s)
+{
+	int i;
+
+	stroke_flush(s);
+
+	for (i = 0; i < s->cov_w * s->cov_h; ++i)
+		free(s->cov[i]);
+
+	free(s->cov);
+	free(s->row);
+	free(s->src);
+	free(s->dx0);
+	free(s->dx1);
+	free(s);
+}
@@ -36,6 +36,9 @@
 #define COLX(i)  (LABELW + PAD + (i) * PITCH)
 #define TB_WIDTH (COLX(2) + BTN + PAD + 15)
 
+/* pixels the busy block of the progress bar slides per slice */
+#define PULSE_STEP (3)
+
 /* colors */
 #define C_BG          (0xffffff)
 #define C_BORDER      (0xc8c8c8)
@@ -44,6 +47,7 @@
 #define C_SEL_BORDER  (0x2f7ef0)
 #define C_LABEL       (0x909090)
 #define C_SWBORDER    (0x9a9a9a)
+#define C_PROGRESS    (0x2f7ef0)
 
 typedef enum {
 	R_SAVE,
@@ -98,9 +102,14 @@ struct Toolbar {
 	uint32_t sel_color;
 	int sel_size;
 	bool fill_mode;
+	/* of the fill being painted, negative when there is none,
+	 * and how far the block showing it is busy has slid when
+	 * its share is unknown, negative otherwise */
+	float progress;
+	int pulse;
 
 	/* vertical offsets of the labelled sections, computed on build */
-	int colors_y0, thick_y0, shapes_y0;
+	int colors_y0, thick_y0, shapes_y0, progress_y0;
 };
 
 static uint8_t
@@ -247,6 +256,9 @@ __toolbar_build_regions(Toolbar *tb)
 		__toolbar_add_region(tb, COLX(col), tb->shapes_y0 + row * PITCH,
 				BTN, BTN, R_TOOL, i);
 	}
+
+	/* fill progress, below the shapes */
+	tb->progress_y0 = tb->shapes_y0 + 2 * PITCH + 8;
 }
 
 /* icon rendering inside a button rect */
@@ -328,6 +340,31 @@ __toolbar_draw_icon(Toolbar *tb, const Region *r)
 	}
 }
 
+static void
+__toolbar_draw_progress(Toolbar *tb)
+{
+	int w = COLX(2) + BTN - COLX(0), x;
+
+	__toolbar_fillrect(tb, COLX(0), tb->progress_y0, w, 6, C_BG);
+
+	if (tb->progress < 0)
+		return;
+
+	if (tb->pulse >= 0) {
+		/* back and forth along the bar */
+		x = tb->pulse % (2 * (w - w / 4));
+		if (x > w - w / 4)
+			x = 2 * (w - w / 4) - x;
+		__toolbar_fillrect(tb, COLX(0) + x, tb->progress_y0,
+				w / 4, 6, C_PROGRESS);
+	} else {
+		__toolbar_fillrect(tb, COLX(0), tb->progress_y0,
+				(int)(w * tb->progress), 6, C_PROGRESS);
+	}
+
+	__toolbar_strokerect(tb, COLX(0), tb->progress_y0, w - 1, 5, C_BORDER, 1);
+}
+
 static void
 __toolbar_draw(Toolbar *tb)
 {
@@ -399,6 +436,8 @@ __toolbar_draw(Toolbar *tb)
 		}
 	}
 
+	__toolbar_draw_progress(tb);
+
 	xcb_flush(tb->conn);
 }
 
@@ -422,6 +461,8 @@ toolbar_new(xcb_connection_t *conn, xcb_window_t parent_win, ToolbarCallbacks cb
 	tb->sel_color = 0xff000000;
 	tb->sel_size = 5;
 	tb->fill_mode = false;
+	tb->progress = -1.0f;
+	tb->pulse = -1;
 
 	xcb_create_window_aux(
 		conn, __x_get_screen_depth(conn),
@@ -578,6 +619,25 @@ toolbar_set_fill_mode(Toolbar *tb, bool fill)
 	__toolbar_draw(tb);
 }
 
+extern void
+toolbar_set_progress(Toolbar *tb, float progress)
+{
+	/* repainting it all on every slice of a fill would flicker */
+	tb->progress = progress;
+	tb->pulse = -1;
+	__toolbar_draw_progress(tb);
+	xcb_flush(tb->conn);
+}
+
+extern void
+toolbar_pulse_progress(Toolbar *tb)
+{
+	tb->progress = 0.0f;
+	tb->pulse += PULSE_STEP;
+	__toolbar_draw_progress(tb);
+	xcb_flush(tb->conn);
+}
+
 extern void
 toolbar_free(Toolbar *tb)
 {
@@ -0,0 +1,130 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "blend.h"
+#include "color.h"
+
+/*
+ * Cost per pixel of the blending kernels in sRGB and in linear light
+ * (-g), for the scalar reference and for what blend_init picks, over a
+ * span that fits in the cache. The last two columns are how many times
+ * linear light costs what sRGB does.
+ */
+
+#define SPAN (4096)
+#define PIXELS (64L << 20)
+
+typedef enum {
+	OVER_BG,
+	MIX_COLOR,
+	MIX_COLOR_CONST
+} Kernel;
+
+static uint32_t dst[SPAN], src[SPAN], bg[SPAN];
+static uint8_t alpha[SPAN];
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double
+run(Kernel k, BlendSpace space, int scalar)
+{
+	double t0;
+	long n;
+
+	t0 = now();
+
+	for (n = 0; n < PIXELS; n += SPAN) {
+		switch (k) {
+		case OVER_BG:
+			if (!scalar)
+				blend_over_bg(dst, src, bg, SPAN);
+			else if (space == BLEND_LINEAR)
+				blend_over_bg_linear_scalar(dst, src, bg, SPAN);
+			else
+				blend_over_bg_scalar(dst, src, bg, SPAN);
+			break;
+		case MIX_COLOR:
+			if (!scalar)
+				blend_mix_color(dst, 0xff3366cc, alpha, SPAN);
+			else if (space == BLEND_LINEAR)
+				blend_mix_color_linear_scalar(dst, 0xff3366cc, alpha, SPAN);
+			else
+				blend_mix_color_scalar(dst, 0xff3366cc, alpha, SPAN);
+			break;
+		case MIX_COLOR_CONST:
+			if (!scalar)
+				blend_mix_color_const(dst, 0xff3366cc, 0x80, SPAN);
+			else if (space == BLEND_LINEAR)
+				blend_mix_color_const_linear_scalar(dst, 0xff3366cc, 0x80, SPAN);
+			else
+				blend_mix_color_const_scalar(dst, 0xff3366cc, 0x80, SPAN);
+			break;
+		}
+	}
+
+	return (now() - t0) * 1e9 / PIXELS;
+}
+
+int
+main(void)
+{
+	static const char *names[] = { "over_bg", "mix_color", "mix_color_const" };
+	double ns[3][2][2];
+	int k, s, i;
+
+	srand(1);
+
+	for (i = 0; i < SPAN; ++i) {
+		src[i] = color_premultiply((uint32_t)(rand()) << 16 ^ (uint32_t)(rand()));
+		bg[i] = (i / 8) % 2 ? 0xffcccccc : 0xffffffff;
+		dst[i] = color_premultiply((uint32_t)(rand()) << 16 ^ (uint32_t)(rand()));
+		alpha[i] = (uint8_t)(rand());
+	}
+
+	/* blend_init only ever switches to linear light */
+	for (s = 0; s < 2; ++s) {
+		blend_init(s ? BLEND_LINEAR : BLEND_SRGB);
+		for (k = 0; k < 3; ++k) {
+			ns[k][s][0] = run(k, s ? BLEND_LINEAR : BLEND_SRGB, 1);
+			ns[k][s][1] = run(k, s ? BLEND_LINEAR : BLEND_SRGB, 0);
+		}
+	}
+
+	printf("%-16s %14s %14s %14s %14s %8s %8s\n", "ns/pixel", "srgb scalar",
+			"srgb", "linear scalar", "linear", "scalar", "best");
+
+	for (k = 0; k < 3; ++k)
+		printf("%-16s %14.2f %14.2f %14.2f %14.2f %7.1fx %7.1fx\n", names[k],
+				ns[k][0][0], ns[k][0][1], ns[k][1][0], ns[k][1][1],
+				ns[k][1][0] / ns[k][0][0], ns[k][1][1] / ns[k][0][1]);
+
+	return 0;
+}
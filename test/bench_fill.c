@@ -0,0 +1,138 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <xcb/xcb.h>
+
+#include "blend.h"
+#include "canvas.h"
+#include "fill.h"
+#include "log.h"
+#include "utils.h"
+
+/*
+ * Time of a bucket fill of a large region, on a blank canvas and on one
+ * crossed by walls, with 1 to MAX_THREADS threads labelling it, and the
+ * speedup over the sequential fill. The canvas needs a window, so it
+ * takes a display (Xvfb will do). usage: bench_fill [size]
+ */
+
+#define RUNS (3)
+#define MAX_THREADS (8)
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+walls(Canvas *c, int w, int h)
+{
+	int i, j, x, y, len;
+
+	srand(1);
+
+	for (i = 0; i < w / 8 + h / 8; ++i) {
+		x = rand() % w;
+		y = rand() % h;
+		len = rand() % 512;
+		if (rand() % 2)
+			canvas_fill_hspan(c, x, MIN(w - 1, x + len), y, 0xff000000);
+		else
+			for (j = y; j < MIN(h, y + len); ++j)
+				canvas_set_pixel(c, x, j, 0xff000000);
+	}
+}
+
+/*
+ * Best of RUNS fills of the region of (0, 0), painting it
+ * back in between.
+ */
+static double
+bench(Canvas *c)
+{
+	double t0, best;
+	int i;
+
+	for (i = 0, best = 1e9; i < RUNS; ++i) {
+		t0 = now();
+		fill_flood(c, 0, 0, 0xff3366cc);
+		best = MIN(best, now() - t0);
+		fill_flood(c, 0, 0, 0xffffffff);
+	}
+
+	return best * 1e3;
+}
+
+int
+main(int argc, char **argv)
+{
+	xcb_connection_t *conn;
+	xcb_screen_t *scr;
+	xcb_window_t win;
+	Canvas *c;
+	double t, t1;
+	int w, h, s, n;
+
+	w = h = 8192;
+
+	if (argc > 1)
+		size_parse(argv[1], &w, &h);
+
+	conn = xcb_connect(NULL, NULL);
+
+	if (xcb_connection_has_error(conn))
+		die("can't open display");
+
+	scr = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+	win = xcb_generate_id(conn);
+
+	xcb_create_window(conn, XCB_COPY_FROM_PARENT, win, scr->root, 0, 0, 1, 1,
+			0, XCB_WINDOW_CLASS_INPUT_OUTPUT, scr->root_visual, 0, NULL);
+
+	blend_init(BLEND_SRGB);
+
+	for (s = 0; s < 2; ++s) {
+		c = canvas_new(conn, win, w, h, 0xffffffff);
+		if (s == 1)
+			walls(c, w, h);
+		for (n = 1, t1 = 0; n <= MAX_THREADS; n *= 2) {
+			fill_set_threads(n);
+			t = bench(c);
+			if (n == 1)
+				t1 = t;
+			printf("%dx%d %s, %d thread%s: %.1f ms (%.2fx)\n", w, h,
+					s ? "walls" : "blank", n, n > 1 ? "s" : "",
+					t, t1 / t);
+		}
+		canvas_free(c);
+	}
+
+	xcb_destroy_window(conn, win);
+	xcb_disconnect(conn);
+
+	return 0;
+}
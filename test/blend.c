@@ -0,0 +1,181 @@
+/*
+	Copyright (C) 2026 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* the vectorized kernels are static, test them in place */
+#include "../src/blend.c"
+
+/* long enough to leave a tail to the scalar code */
+#define SPAN (256 + 7)
+
+static int failed;
+
+/*
+ * A pixel whose four channels take every value in [0, 255] as v does,
+ * each in a different order.
+ */
+static uint32_t
+pattern(int v)
+{
+	return (uint32_t)(v) << 24 | (uint32_t)(255 - v) << 16 |
+			(uint32_t)(v ^ 0x5a) << 8 | (uint32_t)((v * 7) & 0xff);
+}
+
+static int
+check(const char *name, const uint32_t *got, const uint32_t *want)
+{
+	int i;
+
+	for (i = 0; i < SPAN; ++i) {
+		if (got[i] != want[i]) {
+			printf("%s: pixel %d is %08x, expected %08x\n",
+					name, i, got[i], want[i]);
+			failed = 1;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Every source alpha, with every value of every channel of the source
+ * and the background.
+ */
+static void
+test_over_bg(const char *name, BlendOverBgFunc kernel,
+		uint32_t (*ref)(uint32_t, uint32_t))
+{
+	uint32_t src[SPAN], bg[SPAN], got[SPAN], want[SPAN];
+	int a, v, i;
+
+	for (a = 0; a < 256; ++a) {
+		for (v = 0; v < 256; ++v) {
+			for (i = 0; i < SPAN; ++i) {
+				src[i] = (uint32_t)(a) << 24 | (pattern(i & 0xff) & 0xffffff);
+				bg[i] = pattern(v);
+				want[i] = ref(src[i], bg[i]);
+			}
+			kernel(got, src, bg, SPAN);
+			if (!check(name, got, want))
+				return;
+		}
+	}
+
+	printf("%s: ok\n", name);
+}
+
+/*
+ * Every alpha, with every value of every channel of the color and the
+ * destination. The alpha changes along the span, so each lane gets them
+ * all.
+ */
+static void
+test_mix_color(const char *name, BlendMixColorFunc kernel,
+		uint32_t (*ref)(uint32_t, uint32_t, uint8_t))
+{
+	uint32_t got[SPAN], want[SPAN], color;
+	uint8_t alpha[SPAN];
+	int a, v, i;
+
+	for (a = 0; a < 256; ++a) {
+		for (v = 0; v < 256; ++v) {
+			color = pattern(v);
+			for (i = 0; i < SPAN; ++i) {
+				alpha[i] = (uint8_t)(a + i);
+				got[i] = pattern(i & 0xff);
+				want[i] = ref(color, got[i], alpha[i]);
+			}
+			kernel(got, color, alpha, SPAN);
+			if (!check(name, got, want))
+				return;
+		}
+	}
+
+	printf("%s: ok\n", name);
+}
+
+static void
+test_mix_color_const(const char *name, BlendMixColorConstFunc kernel,
+		uint32_t (*ref)(uint32_t, uint32_t, uint8_t))
+{
+	uint32_t got[SPAN], want[SPAN], color;
+	int a, v, i;
+
+	for (a = 0; a < 256; ++a) {
+		for (v = 0; v < 256; ++v) {
+			color = pattern(v);
+			for (i = 0; i < SPAN; ++i) {
+				got[i] = pattern(i & 0xff);
+				want[i] = ref(color, got[i], (uint8_t)(a));
+			}
+			kernel(got, color, (uint8_t)(a), SPAN);
+			if (!check(name, got, want))
+				return;
+		}
+	}
+
+	printf("%s: ok\n", name);
+}
+
+#ifdef BLEND_X86
+static void
+test_kernels(const char *isa, BlendOverBgFunc over_bg,
+		BlendMixColorFunc mix_color, BlendMixColorConstFunc mix_color_const,
+		uint32_t (*over_ref)(uint32_t, uint32_t),
+		uint32_t (*mix_ref)(uint32_t, uint32_t, uint8_t))
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "blend_over_bg_%s", isa);
+	test_over_bg(name, over_bg, over_ref);
+	snprintf(name, sizeof(name), "blend_mix_color_%s", isa);
+	test_mix_color(name, mix_color, mix_ref);
+	snprintf(name, sizeof(name), "blend_mix_color_const_%s", isa);
+	test_mix_color_const(name, mix_color_const, mix_ref);
+}
+#endif
+
+int
+main(void)
+{
+	color_linear_init();
+
+#ifdef BLEND_X86
+	__builtin_cpu_init();
+
+	test_kernels("sse2", __blend_over_bg_sse2, __blend_mix_color_sse2,
+			__blend_mix_color_const_sse2, color_over, color_mix);
+
+	if (__builtin_cpu_supports("avx2")) {
+		test_kernels("avx2", __blend_over_bg_avx2, __blend_mix_color_avx2,
+				__blend_mix_color_const_avx2, color_over, color_mix);
+		test_kernels("linear_avx2", __blend_over_bg_linear_avx2,
+				__blend_mix_color_linear_avx2, __blend_mix_color_const_linear_avx2,
+				color_over_linear, color_mix_linear);
+	} else {
+		puts("no avx2, its kernels are not tested");
+	}
+#else
+	puts("no vectorized kernels to test");
+#endif
+
+	return failed;
+}